@@ -0,0 +1,239 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <math.h>
+
+#include "brush.h"
+
+/* dab widths are quantised to 1/4 px, positions to 1/4 px phases */
+#define BRUSH_STEPS 4
+
+typedef struct
+{
+  guint            key;
+  cairo_surface_t *mask;
+  gint             center;   /* dab center in the mask, minus the phase */
+  GList           *link;     /* in data->brush_lru */
+} GromitDab;
+
+
+static void brush_dab_free (gpointer ptr)
+{
+  GromitDab *dab = ptr;
+  cairo_surface_destroy (dab->mask);
+  g_free (dab);
+}
+
+
+/*
+ * renders a dab of the given quantised width and phase
+ */
+static GromitDab *brush_dab_new (guint key, guint width, guint phx, guint phy,
+                                 gboolean antialias, guint scale)
+{
+  GromitDab *dab = g_new0 (GromitDab, 1);
+  gdouble radius = MAX (width / (2.0 * BRUSH_STEPS), 0.5);
+  gint size = 2 * ((gint) ceil (radius) + 2);
+
+  dab->key = key;
+  dab->center = size / 2;
+  /* at the resolution of the backbuffer */
+  dab->mask = cairo_image_surface_create (CAIRO_FORMAT_A8, size * scale, size * scale);
+  cairo_surface_set_device_scale (dab->mask, scale, scale);
+
+  cairo_t *cr = cairo_create (dab->mask);
+  cairo_set_antialias (cr, antialias ? CAIRO_ANTIALIAS_GRAY : CAIRO_ANTIALIAS_NONE);
+  cairo_arc (cr,
+             dab->center + (gdouble) phx / BRUSH_STEPS,
+             dab->center + (gdouble) phy / BRUSH_STEPS,
+             radius, 0, 2 * M_PI);
+  cairo_fill (cr);
+  cairo_destroy (cr);
+  /* its pixels are read directly, see brush_stamp_dab() */
+  cairo_surface_flush (dab->mask);
+
+  return dab;
+}
+
+
+/*
+ * looks up a dab in the cache, rendering and possibly evicting as needed
+ */
+static GromitDab *brush_dab_get (GromitData *data, guint width,
+                                 guint phx, guint phy, gboolean antialias)
+{
+  guint key = ((((width * BRUSH_STEPS + phx) * BRUSH_STEPS + phy) * 2 + antialias)
+               * (GROMIT_MAX_SCALE + 1) + data->scale);
+  GromitDab *dab;
+
+  if (!data->brush_cache)
+    {
+      data->brush_cache = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                 NULL, brush_dab_free);
+      data->brush_lru = g_queue_new ();
+    }
+
+  dab = g_hash_table_lookup (data->brush_cache, GUINT_TO_POINTER (key));
+  if (dab)
+    {
+      /* most recently used first */
+      g_queue_unlink (data->brush_lru, dab->link);
+      g_queue_push_head_link (data->brush_lru, dab->link);
+      return dab;
+    }
+
+  if (g_queue_get_length (data->brush_lru) >= GROMIT_BRUSH_CACHE_SIZE)
+    {
+      gpointer old = g_queue_pop_tail (data->brush_lru);
+      g_hash_table_remove (data->brush_cache, old);
+    }
+
+  dab = brush_dab_new (key, width, phx, phy, antialias, data->scale);
+  g_queue_push_head (data->brush_lru, GUINT_TO_POINTER (key));
+  dab->link = g_queue_peek_head_link (data->brush_lru);
+  g_hash_table_insert (data->brush_cache, GUINT_TO_POINTER (key), dab);
+
+  return dab;
+}
+
+
+/*
+ * puts a dab into the coverage mask, which is placed at (rect->x, rect->y)
+ */
+static void brush_stamp_dab (GromitData *data, cairo_surface_t *coverage,
+                             gdouble x, gdouble y, gdouble width,
+                             gboolean antialias, GdkRectangle *rect)
+{
+  gint ix = floor (x), iy = floor (y);
+  gint phx = floor ((x - ix) * BRUSH_STEPS + 0.5);
+  gint phy = floor ((y - iy) * BRUSH_STEPS + 0.5);
+  gint scale = data->scale;
+
+  if (phx == BRUSH_STEPS)
+    {
+      ++ix;
+      phx = 0;
+    }
+  if (phy == BRUSH_STEPS)
+    {
+      ++iy;
+      phy = 0;
+    }
+
+  /* tile workers share the cache, keep the mask even if it gets evicted */
+  g_mutex_lock (&data->brush_lock);
+  GromitDab *dab = brush_dab_get (data, (guint) (width * BRUSH_STEPS + 0.5),
+                                  phx, phy, antialias);
+  cairo_surface_t *mask = cairo_surface_reference (dab->mask);
+  gint center = dab->center;
+  g_mutex_unlock (&data->brush_lock);
+
+  /* cairo has no operator taking the maximum of two coverages */
+  guchar *src = cairo_image_surface_get_data (mask);
+  gint src_stride = cairo_image_surface_get_stride (mask);
+  gint size = cairo_image_surface_get_width (mask);
+  guchar *dst = cairo_image_surface_get_data (coverage);
+  gint dst_stride = cairo_image_surface_get_stride (coverage);
+  gint dst_width = cairo_image_surface_get_width (coverage);
+  gint dst_height = cairo_image_surface_get_height (coverage);
+  gint ox = (ix - center - rect->x) * scale;
+  gint oy = (iy - center - rect->y) * scale;
+  gint row, col;
+
+  for (row = MAX (0, -oy); row < size && oy + row < dst_height; ++row)
+    {
+      const guchar *s = src + row * src_stride;
+      guchar *d = dst + (oy + row) * dst_stride + ox;
+      for (col = MAX (0, -ox); col < size && ox + col < dst_width; ++col)
+        if (s[col] > d[col])
+          d[col] = s[col];
+    }
+
+  cairo_surface_destroy (mask);
+}
+
+
+/*
+ * stamps dabs along the polyline given by the samples, interpolating
+ * the width between them
+ */
+void brush_stamp (GromitData *data, cairo_t *cr,
+                  GromitStrokeSample *s, guint n,
+                  GdkRectangle *rect)
+{
+  gboolean antialias = cairo_get_antialias (cr) != CAIRO_ANTIALIAS_NONE;
+  gdouble x1 = G_MAXDOUBLE, y1 = G_MAXDOUBLE, x2 = -G_MAXDOUBLE, y2 = -G_MAXDOUBLE;
+  cairo_surface_t *coverage;
+  guint i;
+
+  if (n == 0)
+    return;
+
+  /* dabs reach up to two pixels past their radius, see brush_dab_new() */
+  for (i = 0; i < n; ++i)
+    {
+      gdouble r = s[i].width / 2.0 + 4;
+      x1 = MIN (x1, s[i].x - r);
+      y1 = MIN (y1, s[i].y - r);
+      x2 = MAX (x2, s[i].x + r);
+      y2 = MAX (y2, s[i].y + r);
+    }
+  rect->x = floor (x1);
+  rect->y = floor (y1);
+  rect->width = ceil (x2) - rect->x;
+  rect->height = ceil (y2) - rect->y;
+
+  coverage = cairo_image_surface_create (CAIRO_FORMAT_A8, rect->width * data->scale,
+                                         rect->height * data->scale);
+  cairo_surface_set_device_scale (coverage, data->scale, data->scale);
+  cairo_surface_flush (coverage);
+
+  brush_stamp_dab (data, coverage, s[0].x, s[0].y, s[0].width, antialias, rect);
+
+  for (i = 1; i < n; ++i)
+    {
+      gdouble dx = s[i].x - s[i-1].x;
+      gdouble dy = s[i].y - s[i-1].y;
+      gdouble d = sqrt (dx * dx + dy * dy);
+      /* a fifth of the diameter apart looks continuous */
+      gdouble spacing = MAX (0.2 * MIN (s[i-1].width, s[i].width), 0.5);
+      guint steps = ceil (d / spacing);
+      guint j;
+
+      for (j = 1; j <= steps; ++j)
+        {
+          gdouble t = (gdouble) j / steps;
+          brush_stamp_dab (data, coverage,
+                           s[i-1].x + t * dx,
+                           s[i-1].y + t * dy,
+                           s[i-1].width + t * (s[i].width - s[i-1].width),
+                           antialias, rect);
+        }
+    }
+
+  /* the whole batch is blended once, at an integer offset */
+  cairo_surface_mark_dirty (coverage);
+  cairo_mask_surface (cr, coverage, rect->x, rect->y);
+  cairo_surface_destroy (coverage);
+}
+
@@ -0,0 +1,49 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef BRUSH_H
+#define BRUSH_H
+
+/*
+  Brush engine for pressure pens.
+
+  Tablet strokes are drawn as a row of round dabs instead of outlines.
+  A dab is an A8 mask rendered once per quantised width, subpixel phase
+  and antialiasing mode and kept in a small LRU cache. The dabs of a batch
+  of samples are combined into one A8 coverage mask by taking the maximum
+  per pixel, and only that mask is blended with the current source. So
+  the antialiased rim, which many overlapping dabs touch, keeps the
+  coverage of a single dab, like an outline drawn by draw_stroke().
+*/
+
+#include "main.h"
+#include "drawing.h"
+
+/* number of dab masks kept around */
+#define GROMIT_BRUSH_CACHE_SIZE 256
+
+void brush_stamp (GromitData *data, cairo_t *cr,
+                  GromitStrokeSample *samples, guint n,
+                  GdkRectangle *rect);
+
+#endif
@@ -32,6 +32,12 @@
 #include "drawing.h"
 #include "build-config.h"
 #include "coordlist_ops.h"
+#include "lasso.h"
+#include "lens.h"
+#include "predict.h"
+#include "present.h"
+#include "stamp.h"
+#include "undo.h"
 
 gboolean on_expose (GtkWidget *widget,
 		    cairo_t* cr,
@@ -42,12 +48,32 @@ gboolean on_expose (GtkWidget *widget,
   if(data->debug)
     g_printerr("DEBUG: got draw event\n");
 
+  /* the presenter only knows about the backbuffer */
+  if (!scratch_active (data) && present_expose (data, cr))
+    return TRUE;
+
   cairo_save (cr);
+  /* parts of the screen no monitor shows need no painting */
+  if (data->monitors && data->monitors->len > 1)
+    {
+      guint i;
+      for (i = 0; i < data->monitors->len; ++i)
+        gdk_cairo_rectangle (cr, &g_array_index (data->monitors, GromitMonitor, i).geometry);
+      cairo_clip (cr);
+    }
   cairo_set_source_surface (cr, data->backbuffer, 0, 0);
   cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
   cairo_paint (cr);
   cairo_restore (cr);
 
+  lasso_expose (data, cr);
+  scratch_expose (data, cr);
+  fade_expose (data, cr);
+  text_expose (data, cr);
+  spotlight_expose (data, cr);
+  lens_expose (data, cr);
+  predict_expose (data, cr);
+
   if (data->debug) {
       // draw a pink background to know where the window is
       cairo_save (cr);
@@ -91,6 +117,8 @@ void on_screen_changed(GtkWidget *widget,
   if (visual == NULL)
     visual = gdk_screen_get_system_visual (screen);
 
+  /* the presenter's GC belongs to the old window setup */
+  present_free (data);
   gtk_widget_set_visual (widget, visual);
 }
 
@@ -101,12 +129,22 @@ void on_monitors_changed ( GdkScreen *screen,
 {
   GromitData *data = (GromitData *) user_data;
 
+  GArray *old_monitors = data->monitors;
+  guint old_width = data->width, old_height = data->height;
+  gboolean moved = FALSE;
+  guint i, j;
+
   // get new sizes
   data->width = gdk_screen_get_width (data->screen);
   data->height = gdk_screen_get_height (data->screen);
+  data->monitors = monitors_new (data);
+  data->xinerama = data->monitors->len > 1;
+  guint old_scale = data->scale;
+  data->scale = canvas_scale (data);
 
   if(data->debug)
-    g_printerr("DEBUG: screen size changed to %d x %d!\n", data->width, data->height);
+    g_printerr("DEBUG: screen size changed to %d x %d, %u monitors!\n",
+               data->width, data->height, data->monitors->len);
 
   // change size
   gtk_widget_set_size_request(GTK_WIDGET(data->win), data->width, data->height);
@@ -115,37 +153,105 @@ void on_monitors_changed ( GdkScreen *screen,
   gtk_widget_input_shape_combine_region(data->win, r);
   cairo_region_destroy(r);
 
-  /* recreate the shape surface */
-  cairo_surface_t *new_shape = cairo_image_surface_create(CAIRO_FORMAT_ARGB32 ,data->width, data->height);
-  cairo_t *cr = cairo_create (new_shape);
-  cairo_set_source_surface (cr, data->backbuffer, 0, 0);
-  cairo_paint (cr);
-  cairo_destroy (cr);
-  cairo_surface_destroy(data->backbuffer);
-  data->backbuffer = new_shape;
-
-  // recreate auxiliary backbuffer
-  cairo_surface_destroy(data->aux_backbuffer);
-  data->aux_backbuffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, data->width, data->height);
-
   /*
-     these depend on the shape surface
+     Annotations belong to the monitor they were drawn on: find out which
+     monitors are still there and whether any of them moved.
   */
-  GHashTableIter it;
-  gpointer value;
-  g_hash_table_iter_init (&it, data->tool_config);
-  while (g_hash_table_iter_next (&it, NULL, &value)) 
-    paint_context_free(value);
-  g_hash_table_remove_all(data->tool_config);
+  gint *match = g_new (gint, data->monitors->len);
+  cairo_region_t *kept = cairo_region_create ();
+  cairo_region_t *stale = cairo_region_create ();
 
+  for (i = 0; i < data->monitors->len; ++i)
+    {
+      GromitMonitor *m = &g_array_index (data->monitors, GromitMonitor, i);
+      match[i] = -1;
+      for (j = 0; j < old_monitors->len; ++j)
+        if (g_array_index (old_monitors, GromitMonitor, j).monitor == m->monitor)
+          match[i] = j;
 
-  parse_config(data); // also calls paint_context_new() :-(
+      if (match[i] < 0)
+        {
+          cairo_region_union_rectangle (stale, (cairo_rectangle_int_t *) &m->geometry);
+          continue;
+        }
 
+      GdkRectangle *old = &g_array_index (old_monitors, GromitMonitor, match[i]).geometry;
+      if (old->x != m->geometry.x || old->y != m->geometry.y)
+        moved = TRUE;
+      cairo_region_union_rectangle (kept, (cairo_rectangle_int_t *) &m->geometry);
+    }
 
-  data->default_pen = paint_context_new (data, GROMIT_PEN, data->red, 7, 0, GROMIT_ARROW_END,
-                                         5, 10, 15, 25, 1, 0, G_MAXUINT);
-  data->default_eraser = paint_context_new (data, GROMIT_ERASER, data->red, 75, 0, GROMIT_ARROW_END,
-                                            5, 10, 15, 25, 1, 0, G_MAXUINT);
+  for (j = 0; j < old_monitors->len; ++j)
+    {
+      GdkMonitor *monitor = g_array_index (old_monitors, GromitMonitor, j).monitor;
+      gboolean gone = TRUE;
+      for (i = 0; i < data->monitors->len; ++i)
+        if (g_array_index (data->monitors, GromitMonitor, i).monitor == monitor)
+          gone = FALSE;
+      if (gone)
+        cairo_region_union_rectangle (stale,
+                                      (cairo_rectangle_int_t *) &g_array_index (old_monitors, GromitMonitor, j).geometry);
+    }
+
+  if (moved || data->width != old_width || data->height != old_height || data->scale != old_scale)
+    {
+      /* recreate the shape surface, taking along what is on the remaining monitors */
+      cairo_surface_t *new_shape = present_surface_new(data, data->width, data->height);
+      cairo_t *cr = cairo_create (new_shape);
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+      for (i = 0; i < data->monitors->len; ++i)
+        {
+          if (match[i] < 0)
+            continue;
+          GdkRectangle *new = &g_array_index (data->monitors, GromitMonitor, i).geometry;
+          GdkRectangle *old = &g_array_index (old_monitors, GromitMonitor, match[i]).geometry;
+          cairo_save (cr);
+          gdk_cairo_rectangle (cr, new);
+          cairo_clip (cr);
+          cairo_set_source_surface (cr, data->backbuffer, new->x - old->x, new->y - old->y);
+          cairo_paint (cr);
+          cairo_restore (cr);
+        }
+      cairo_destroy (cr);
+      cairo_surface_destroy(data->backbuffer);
+      data->backbuffer = new_shape;
+
+      // recreate auxiliary backbuffer
+      cairo_surface_destroy(data->aux_backbuffer);
+      data->aux_backbuffer = canvas_surface_new(data);
+
+      scratch_pool_clear(data);
+      fade_clear(data);
+
+      GdkRectangle rect = {0, 0, data->width, data->height};
+      gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+    }
+  else
+    {
+      /* same layout, only clear what was on monitors that are gone or new */
+      cairo_region_subtract (stale, kept);
+      cairo_t *cr = cairo_create (data->backbuffer);
+      cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+      gdk_cairo_region (cr, stale);
+      cairo_fill (cr);
+      cairo_destroy (cr);
+
+      gdk_window_invalidate_region(gtk_widget_get_window(data->win), stale, 0);
+    }
+
+  if(data->debug)
+    g_printerr("DEBUG: %s backbuffer after monitor change.\n", moved ? "Rearranged" : "Kept");
+
+  g_free (match);
+  cairo_region_destroy (kept);
+  cairo_region_destroy (stale);
+  g_array_unref (old_monitors);
+
+  // recorded ops and keyframes refer to the old layout
+  undo_init(data);
+
+  /* paint contexts rebind to the new shape surface when next used */
+  data->backbuffer_generation++;
 
   if(!data->composited) // set shape
     {
@@ -180,16 +286,10 @@ void on_composited_changed ( GdkScreen *screen,
       gtk_widget_set_opacity(data->win, 0.75);
     }
 
-  // set anti-aliasing
-  GHashTableIter it;
-  gpointer value;
-  g_hash_table_iter_init (&it, data->tool_config);
-  while (g_hash_table_iter_next (&it, NULL, &value)) 
-    {
-      GromitPaintContext *context = value;
-      cairo_set_antialias(context->paint_ctx, data->composited ? CAIRO_ANTIALIAS_SUBPIXEL : CAIRO_ANTIALIAS_NONE);
-    }
-      
+  // anti-aliasing is set up when the paint contexts are recreated
+  data->backbuffer_generation++;
+  present_update (data);
+
 
   GdkRectangle rect = {0, 0, data->width, data->height};
   gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0); 
@@ -211,7 +311,9 @@ void on_clientapp_selection_get (GtkWidget          *widget,
     g_printerr("DEBUG: clientapp received request.\n");  
 
 
-  if (gtk_selection_data_get_target(selection_data) == GA_TOGGLEDATA || gtk_selection_data_get_target(selection_data) == GA_LINEDATA)
+  if (gtk_selection_data_get_target(selection_data) == GA_TOGGLEDATA ||
+      gtk_selection_data_get_target(selection_data) == GA_LINEDATA ||
+      gtk_selection_data_get_target(selection_data) == GA_UNDOGOTODATA)
     {
       ans = data->clientdata;
     }
@@ -236,6 +338,11 @@ void on_clientapp_selection_received (GtkWidget *widget,
   else
     data->client = 1;
 
+  if(gtk_selection_data_get_target(selection_data) == GA_UNDOTREE &&
+     gtk_selection_data_get_length(selection_data) > 0)
+    g_print ("%.*s", gtk_selection_data_get_length(selection_data),
+             (gchar*)gtk_selection_data_get_data(selection_data));
+
   gtk_main_quit ();
 }
 
@@ -244,6 +351,27 @@ void on_clientapp_selection_received (GtkWidget *widget,
 static float line_thickener = 0;
 
 
+/*
+ * line width of a sample with the given pressure, looked up in the
+ * tool's table and widened by the pen's tilt if the tool asks for it
+ */
+static gfloat sample_width (GromitPaintContext *context, GdkDevice *device,
+                            gdouble *axes, gdouble pressure)
+{
+  guint i = CLAMP (pressure + line_thickener, 0, 1) * (GROMIT_PRESSURE_LUT_SIZE - 1) + 0.5;
+  gfloat width = context->pressure_lut[i];
+  gdouble xtilt, ytilt;
+
+  if (context->tilt != 0 &&
+      gdk_device_get_axis (device, axes, GDK_AXIS_XTILT, &xtilt) &&
+      gdk_device_get_axis (device, axes, GDK_AXIS_YTILT, &ytilt))
+    width = CLAMP (width * (1 + context->tilt * MIN (hypot (xtilt, ytilt), 1)),
+                   1, context->maxwidth);
+
+  return width;
+}
+
+
 gboolean on_buttonpress (GtkWidget *win, 
 			 GdkEventButton *ev,
 			 gpointer user_data)
@@ -280,8 +408,80 @@ gboolean on_buttonpress (GtkWidget *win,
 
   GromitPaintType type = devdata->cur_context->type;
 
+  /* another tool drops the selection where it was */
+  if (type != GROMIT_LASSO)
+    lasso_end (data, devdata);
+  /* any click finishes typing */
+  text_end (data, devdata);
+  /* a new stroke starts a new prediction */
+  predict_end (data, devdata);
+
+  if (type == GROMIT_SPOTLIGHT)
+    {
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      spotlight_move (data, devdata, ev->x, ev->y);
+      return TRUE;
+    }
+
+  if (type == GROMIT_LENS)
+    {
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      lens_move (data, devdata, ev->x, ev->y);
+      return TRUE;
+    }
+
+  if (type == GROMIT_FILL)
+    {
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      /* a stroke whose button release we never saw */
+      scratch_commit (data, devdata);
+      undo_op_commit (data, devdata);
+      draw_fill (data, ev->device, ev->x, ev->y);
+      return TRUE;
+    }
+
+  if (type == GROMIT_STAMP)
+    {
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      scratch_commit (data, devdata);
+      undo_op_commit (data, devdata);
+      draw_stamp (data, ev->device, ev->x, ev->y);
+      return TRUE;
+    }
+
+  if (type == GROMIT_LASSO)
+    {
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      scratch_commit (data, devdata);
+      undo_op_commit (data, devdata);
+      lasso_press (data, devdata, ev->x, ev->y);
+      return TRUE;
+    }
+
+  if (type == GROMIT_TEXT)
+    {
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      scratch_commit (data, devdata);
+      undo_op_commit (data, devdata);
+      text_begin (data, devdata, ev->x, ev->y);
+      return TRUE;
+    }
+
   // store original state to have dynamic update of line and rect
-  if (type == GROMIT_LINE || type == GROMIT_RECT || type == GROMIT_SMOOTH || type == GROMIT_ORTHOGONAL || type == GROMIT_CIRCLE)
+  if (type == GROMIT_LINE || type == GROMIT_RECT || type == GROMIT_SMOOTH || type == GROMIT_ORTHOGONAL || type == GROMIT_CIRCLE ||
+      devdata->cur_context->recognize > 0)
     {
       copy_surface(data->aux_backbuffer, data->backbuffer);
     }
@@ -289,23 +489,23 @@ gboolean on_buttonpress (GtkWidget *win,
   devdata->lastx = ev->x;
   devdata->lasty = ev->y;
   devdata->motion_time = ev->time;
+  stabilizer_reset (&devdata->stabilizer, ev->x, ev->y, ev->time);
 
-  snap_undo_state (data);
+  scratch_begin (data, devdata);
+  undo_op_begin (data, devdata);
 
   gdk_event_get_axis ((GdkEvent *) ev, GDK_AXIS_PRESSURE, &pressure);
-  data->maxwidth = (CLAMP (pressure + line_thickener, 0, 1) *
-		    (double) (devdata->cur_context->width -
-			      devdata->cur_context->minwidth) +
-		    devdata->cur_context->minwidth);
+  data->maxwidth = sample_width (devdata->cur_context, ev->device, ev->axes, pressure);
 
-  if(data->maxwidth > devdata->cur_context->maxwidth)
-    data->maxwidth = devdata->cur_context->maxwidth;
+  devdata->lastwidth = data->maxwidth;
 
   if (ev->button <= 5)
     draw_line (data, ev->device, ev->x, ev->y, ev->x, ev->y);
 
   coord_list_prepend (data, ev->device, ev->x, ev->y, data->maxwidth);
 
+  predict_add (data, devdata, ev->x, ev->y, data->maxwidth, ev->time);
+
   return TRUE;
 }
 
@@ -334,13 +534,49 @@ gboolean on_motion (GtkWidget *win,
 
   GromitPaintType type = devdata->cur_context->type;
 
+  /* stays a spotlight or lens until released, whatever the modifiers say */
+  if (devdata->spotlight || devdata->lens)
+    {
+      if (devdata->spotlight)
+        spotlight_move (data, devdata, ev->x, ev->y);
+      else
+        lens_move (data, devdata, ev->x, ev->y);
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      return TRUE;
+    }
+
+  /* stays a lasso until released, whatever the modifiers say */
+  if (devdata->lasso)
+    {
+      lasso_motion (data, devdata, ev->x, ev->y);
+      devdata->lastx = ev->x;
+      devdata->lasty = ev->y;
+      devdata->motion_time = ev->time;
+      return TRUE;
+    }
+
+  /* a fill, text or stamp happens on button press only */
+  if (type == GROMIT_FILL || type == GROMIT_TEXT || type == GROMIT_STAMP)
+    {
+      devdata->motion_time = ev->time;
+      return TRUE;
+    }
+
+  /* freehand samples of this event, drawn as one outline at the end */
+  GromitStrokeSample sample = { devdata->lastx, devdata->lasty, devdata->lastwidth };
+  GArray *stroke = g_array_new (FALSE, FALSE, sizeof (GromitStrokeSample));
+  g_array_append_val (stroke, sample);
+
   gdk_device_get_history (ev->device, ev->window,
 			  devdata->motion_time, ev->time,
 			  &coords, &nevents);
 
   if(!data->xinerama && nevents > 0)
     {
-      if (type != GROMIT_LINE && type != GROMIT_RECT)
+      /* shapes are redrawn from the press point, history would only leave a trail */
+      if (type != GROMIT_LINE && type != GROMIT_RECT && type != GROMIT_CIRCLE)
         {
           for (i=0; i < nevents; i++)
             {
@@ -350,24 +586,27 @@ gboolean on_motion (GtkWidget *win,
                                    GDK_AXIS_PRESSURE, &pressure);
               if (pressure > 0)
                 {
-                  data->maxwidth = (CLAMP (pressure + line_thickener, 0, 1) *
-                                    (double) (devdata->cur_context->width -
-                                              devdata->cur_context->minwidth) +
-                                    devdata->cur_context->minwidth);
-
-                  if(data->maxwidth > devdata->cur_context->maxwidth)
-                    data->maxwidth = devdata->cur_context->maxwidth;
+                  data->maxwidth = sample_width (devdata->cur_context, ev->device,
+                                                 coords[i]->axes, pressure);
 
                   gdk_device_get_axis(ev->device, coords[i]->axes,
                                       GDK_AXIS_X, &x);
                   gdk_device_get_axis(ev->device, coords[i]->axes,
                                       GDK_AXIS_Y, &y);
+                  if (devdata->cur_context->stabilize > 0)
+                    stabilizer_filter (&devdata->stabilizer, devdata->cur_context->stabilize,
+                                       devdata->cur_context->stabilize_beta, &x, &y, coords[i]->time);
 
-                  draw_line (data, ev->device, devdata->lastx, devdata->lasty, x, y);
+                  sample.x = x;
+                  sample.y = y;
+                  sample.width = data->maxwidth;
+                  g_array_append_val (stroke, sample);
 
                   coord_list_prepend (data, ev->device, x, y, data->maxwidth);
+                  predict_add (data, devdata, x, y, data->maxwidth, coords[i]->time);
                   devdata->lastx = x;
                   devdata->lasty = y;
+                  devdata->lastwidth = data->maxwidth;
                 }
             }
         }
@@ -377,17 +616,12 @@ gboolean on_motion (GtkWidget *win,
     }
 
   /* always paint to the current event coordinate. */
+  gdouble evx = ev->x, evy = ev->y;
   gdk_event_get_axis ((GdkEvent *) ev, GDK_AXIS_PRESSURE, &pressure);
 
   if (pressure > 0)
     {
-      data->maxwidth = (CLAMP (pressure + line_thickener, 0, 1) *
-			(double) (devdata->cur_context->width -
-				  devdata->cur_context->minwidth) +
-			devdata->cur_context->minwidth);
-
-      if(data->maxwidth > devdata->cur_context->maxwidth)
-	data->maxwidth = devdata->cur_context->maxwidth;
+      data->maxwidth = sample_width (devdata->cur_context, ev->device, ev->axes, pressure);
 
       if(devdata->motion_time > 0)
 	{
@@ -395,6 +629,9 @@ gboolean on_motion (GtkWidget *win,
             copy_surface(data->backbuffer, data->aux_backbuffer);
             GdkRectangle rect = {0, 0, data->width, data->height};
             gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+            if (devdata->cur_op)
+              undo_op_reset (devdata->cur_op);
+            scratch_reset (data, devdata);
           }
           if (type == GROMIT_LINE)
             {
@@ -428,16 +665,30 @@ gboolean on_motion (GtkWidget *win,
             }
           else
             {
-              draw_line (data, ev->device, devdata->lastx, devdata->lasty, ev->x, ev->y);
-	      coord_list_prepend (data, ev->device, ev->x, ev->y, data->maxwidth);
+              /* freehand strokes follow the pointer as stabilized */
+              if (devdata->cur_context->stabilize > 0)
+                stabilizer_filter (&devdata->stabilizer, devdata->cur_context->stabilize,
+                                   devdata->cur_context->stabilize_beta, &evx, &evy, ev->time);
+              sample.x = evx;
+              sample.y = evy;
+              sample.width = data->maxwidth;
+              g_array_append_val (stroke, sample);
+	      coord_list_prepend (data, ev->device, evx, evy, data->maxwidth);
+              predict_add (data, devdata, evx, evy, data->maxwidth, ev->time);
             }
 	}
     }
 
+  if (stroke->len > 1)
+    draw_stroke (data, ev->device, (GromitStrokeSample *) stroke->data, stroke->len);
+  g_array_free (stroke, TRUE);
+  predict_update (data, devdata);
+
   if (type != GROMIT_LINE && type != GROMIT_RECT && type != GROMIT_CIRCLE)
     {
-      devdata->lastx = ev->x;
-      devdata->lasty = ev->y;
+      devdata->lastx = evx;
+      devdata->lasty = evy;
+      devdata->lastwidth = sample.width;
     }
   devdata->motion_time = ev->time;
 
@@ -445,6 +696,33 @@ gboolean on_motion (GtkWidget *win,
 }
 
 
+/*
+ * Replaces the stroke drawn so far with the one in the device's
+ * coordinate list, after that was smoothed or recognised.
+ */
+static void redraw_coordlist (GromitData *data,
+                              GromitDeviceData *devdata,
+                              GdkDevice *dev)
+{
+  copy_surface(data->backbuffer, data->aux_backbuffer);
+  GdkRectangle rect = {0, 0, data->width, data->height};
+  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+  if (devdata->cur_op)
+    undo_op_reset (devdata->cur_op);
+  scratch_reset (data, devdata);
+
+  GArray *stroke = g_array_new (FALSE, FALSE, sizeof (GromitStrokeSample));
+  for (GList *ptr = devdata->coordlist; ptr; ptr = ptr->next)
+    {
+      GromitStrokeCoordinate *c = ptr->data;
+      GromitStrokeSample sample = { c->x, c->y, c->width };
+      g_array_append_val (stroke, sample);
+    }
+  draw_stroke (data, dev, (GromitStrokeSample *) stroke->data, stroke->len);
+  g_array_free (stroke, TRUE);
+}
+
+
 gboolean on_buttonrelease (GtkWidget *win, 
 			   GdkEventButton *ev, 
 			   gpointer user_data)
@@ -455,7 +733,7 @@ gboolean on_buttonrelease (GtkWidget *win,
   GromitPaintContext *ctx = devdata->cur_context;
 
   gfloat direction = 0;
-  gint width = 0;
+  gfloat width = 0;
   if(ctx)
     width = ctx->arrowsize * ctx->width / 2;
 
@@ -466,9 +744,48 @@ gboolean on_buttonrelease (GtkWidget *win,
   if (!devdata->is_grabbed)
     return FALSE;
 
+  /* only real ink from here on */
+  predict_end (data, devdata);
+
   GromitPaintType type = ctx->type;
 
-  if (type == GROMIT_SMOOTH || type == GROMIT_ORTHOGONAL)
+  if (devdata->spotlight || devdata->lens)
+    {
+      spotlight_end (data, devdata);
+      lens_end (data, devdata);
+      return TRUE;
+    }
+
+  if (devdata->lasso)
+    {
+      lasso_release (data, devdata);
+      return TRUE;
+    }
+
+  if (type == GROMIT_FILL || type == GROMIT_TEXT || type == GROMIT_STAMP)
+    return TRUE;
+
+  GromitShapeType shape = GROMIT_SHAPE_NONE;
+  gfloat head = 0;
+  if (ctx->recognize > 0)
+    shape = recognize_shape (&devdata->coordlist, ctx->recognize / 100.0, &head);
+
+  if (shape != GROMIT_SHAPE_NONE)
+    {
+      if(data->debug)
+        g_printerr("DEBUG: Recognised shape %d\n", shape);
+
+      redraw_coordlist (data, devdata, ev->device);
+      if (shape == GROMIT_SHAPE_ARROW)
+        {
+          /* the shaft runs from the second coordinate to the tip */
+          GromitStrokeCoordinate *tip = devdata->coordlist->data;
+          GromitStrokeCoordinate *start = devdata->coordlist->next->data;
+          direction = atan2 (tip->y - start->y, tip->x - start->x);
+          draw_arrow (data, ev->device, tip->x, tip->y, head * 2 / 7, direction);
+        }
+    }
+  else if (type == GROMIT_SMOOTH || type == GROMIT_ORTHOGONAL)
     {
       gboolean joined = FALSE;
       douglas_peucker(devdata->coordlist, ctx->simplify);
@@ -482,18 +799,7 @@ gboolean on_buttonrelease (GtkWidget *win,
           round_corners(devdata->coordlist, ctx->radius, 6, joined);
       }
 
-      copy_surface(data->backbuffer, data->aux_backbuffer);
-      GdkRectangle rect = {0, 0, data->width, data->height};
-      gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
-
-      GList *ptr = devdata->coordlist;
-      while (ptr && ptr->next)
-        {
-          GromitStrokeCoordinate *c1 = ptr->data;
-          GromitStrokeCoordinate *c2 = ptr->next->data;
-          ptr = ptr->next;
-          draw_line (data, ev->device, c1->x, c1->y, c2->x, c2->y);
-        }
+      redraw_coordlist (data, devdata, ev->device);
     }
   else if (type == GROMIT_CIRCLE)
     {
@@ -502,11 +808,14 @@ gboolean on_buttonrelease (GtkWidget *win,
       copy_surface(data->backbuffer, data->aux_backbuffer);
       GdkRectangle rect = {0, 0, data->width, data->height};
       gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+      if (devdata->cur_op)
+        undo_op_reset (devdata->cur_op);
+      scratch_reset (data, devdata);
 
       draw_circle (data, ev->device, devdata->lastx, devdata->lasty, radius);
     }
 
-  if (ctx->arrowsize != 0)
+  if (ctx->arrowsize != 0 && shape != GROMIT_SHAPE_ARROW)
     {
       GromitArrowType atype = ctx->arrow_type;
       if (type == GROMIT_LINE)
@@ -519,7 +828,7 @@ gboolean on_buttonrelease (GtkWidget *win,
         }
       else
         {
-          gint x0, y0;
+          gfloat x0, y0;
           if ((atype & GROMIT_ARROW_END) &&
               coord_list_get_arrow_param (data, ev->device, width * 3,
                                           GROMIT_ARROW_END, &x0, &y0, &width, &direction))
@@ -534,9 +843,30 @@ gboolean on_buttonrelease (GtkWidget *win,
 
   coord_list_free (data, ev->device);
 
+  scratch_commit (data, devdata);
+  undo_op_commit (data, devdata);
+
   return TRUE;
 }
 
+/*
+ * keys typed on a keyboard whose pointer is typing text
+ */
+gboolean on_keypress (GtkWidget *win,
+                      GdkEventKey *ev,
+                      gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+  GdkDevice *pointer = gdk_device_get_associated_device (gdk_event_get_device ((GdkEvent *) ev));
+  GromitDeviceData *devdata = pointer ? g_hash_table_lookup (data->devdatatable, pointer) : NULL;
+
+  if (!devdata)
+    return FALSE;
+
+  return text_key (data, devdata, ev->keyval);
+}
+
+
 /* Remote control */
 void on_mainapp_selection_get (GtkWidget          *widget,
 			       GtkSelectionData   *selection_data,
@@ -547,6 +877,7 @@ void on_mainapp_selection_get (GtkWidget          *widget,
   GromitData *data = (GromitData *) user_data;
   
   gchar *uri = "OK";
+  gchar *tree = NULL;
   GdkAtom action = gtk_selection_data_get_target(selection_data);
 
   if(action == GA_TOGGLE)
@@ -563,6 +894,13 @@ void on_mainapp_selection_get (GtkWidget          *widget,
                              GA_LINEDATA, time);
       gtk_main(); /* Wait for the response */
     }
+  else if(action == GA_UNDOGOTO)
+    {
+      /* ask back client for node id */
+      gtk_selection_convert (data->win, GA_DATA,
+                             GA_UNDOGOTODATA, time);
+      gtk_main(); /* Wait for the response */
+    }
   else if (action == GA_VISIBILITY)
     toggle_visibility (data);
   else if (action == GA_CLEAR)
@@ -572,9 +910,11 @@ void on_mainapp_selection_get (GtkWidget          *widget,
   else if (action == GA_QUIT)
     gtk_main_quit ();
   else if (action == GA_UNDO)
-    undo_drawing (data);
+    undo_drawing (data, NULL);
   else if (action == GA_REDO)
-    redo_drawing (data);
+    redo_drawing (data, NULL);
+  else if (action == GA_UNDOTREE)
+    uri = tree = undo_describe (data);
   else
     uri = "NOK";
 
@@ -582,6 +922,7 @@ void on_mainapp_selection_get (GtkWidget          *widget,
   gtk_selection_data_set (selection_data,
                           gtk_selection_data_get_target(selection_data),
                           8, (guchar*)uri, strlen (uri));
+  g_free (tree);
 }
 
 
@@ -673,18 +1014,33 @@ void on_mainapp_selection_received (GtkWidget *widget,
 	  if(data->debug)
 	    g_printerr("DEBUG: draw line from %d %d to %d %d\n", startX, startY, endX, endY);
 
-	  cairo_set_line_width(line_ctx->paint_ctx, thickness);
-	  cairo_move_to(line_ctx->paint_ctx, startX, startY);
-	  cairo_line_to(line_ctx->paint_ctx, endX, endY);
-	  cairo_stroke(line_ctx->paint_ctx);
+	  cairo_t *line_cr = paint_context_cairo(data, line_ctx);
+	  cairo_set_line_width(line_cr, thickness);
+	  cairo_move_to(line_cr, startX, startY);
+	  cairo_line_to(line_cr, endX, endY);
+	  cairo_stroke(line_cr);
 
 	  data->modified = 1;
 	  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0); 
 	  data->painted = 1;
 
-	  g_free(line_ctx);
+	  GromitOp *op = undo_op_new (GROMIT_OP_STROKE, line_ctx);
+	  undo_op_add_line (op, startX, startY, endX, endY, thickness, &rect);
+	  undo_commit (data, op);
+
+	  paint_context_free(line_ctx);
 	  g_free (color);
 	}
+      else if (gtk_selection_data_get_target(selection_data) == GA_UNDOGOTODATA)
+        {
+	  guint id = strtoul((gchar*)gtk_selection_data_get_data(selection_data), NULL, 10);
+
+          if(data->debug)
+	    g_printerr("DEBUG: mainapp got undo node id '%u' back from client.\n", id);
+
+	  if (!undo_goto_node (data, id))
+	    g_printerr("ERROR: No undo history node with id %u.\n", id);
+        }
     }
  
   gtk_main_quit ();
@@ -816,14 +1172,14 @@ void on_undo(GtkMenuItem *menuitem,
 	     gpointer     user_data)
 {
   GromitData *data = (GromitData *) user_data;
-  undo_drawing (data);
+  undo_drawing (data, gtk_get_current_event_device ());
 }
 
 void on_redo(GtkMenuItem *menuitem,
 	     gpointer     user_data)
 {
   GromitData *data = (GromitData *) user_data;
-  redo_drawing (data);
+  redo_drawing (data, gtk_get_current_event_device ());
 }
 
 
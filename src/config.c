@@ -30,6 +30,8 @@
 
 #include "config.h"
 #include "main.h"
+#include "predict.h"
+#include "stamp.h"
 #include "math.h"
 #include "build-config.h"
 
@@ -127,6 +129,18 @@ enum tool_arguments {
   SYM_FILLCOLOR,
   SYM_TEXTSIZE,
   SYM_SHOWLENGTH,
+  SYM_FADE,
+  SYM_SHAPE,
+  SYM_ZOOM,
+  SYM_RECOGNIZE,
+  SYM_IMAGE,
+  SYM_PREDICT,
+  SYM_PREDICTSAMPLES,
+  SYM_STABILIZE,
+  SYM_STABILIZEBETA,
+  SYM_GAMMA,
+  SYM_CURVE,
+  SYM_TILT,
 };
 
 /*
@@ -152,6 +166,51 @@ gfloat parse_get_float(GScanner *scanner, const gchar *msg)
 }
 
 
+static gint curve_point_compare (gconstpointer a, gconstpointer b)
+{
+  const GromitCurvePoint *pa = a, *pb = b;
+  return pa->pressure < pb->pressure ? -1 : pa->pressure > pb->pressure;
+}
+
+/*
+ * parses a pressure curve like "0 0, 0.5 0.2, 1 1" into GromitCurvePoints
+ * sorted by pressure, returns NULL if it is malformed
+ */
+static GArray *parse_curve (const gchar *string)
+{
+  GArray *curve = g_array_new (FALSE, FALSE, sizeof (GromitCurvePoint));
+  gchar **points = g_strsplit (string, ",", -1);
+  gchar **p;
+
+  for (p = points; *p; ++p)
+    {
+      GromitCurvePoint point;
+      gchar *end;
+
+      point.pressure = g_ascii_strtod (*p, &end);
+      if (end == *p)
+        break;
+      gchar *start = end;
+      point.response = g_ascii_strtod (start, &end);
+      if (end == start || point.pressure < 0 || point.pressure > 1 ||
+          point.response < 0 || point.response > 1)
+        break;
+      g_array_append_val (curve, point);
+    }
+
+  if (*p || curve->len == 0)
+    {
+      g_array_free (curve, TRUE);
+      curve = NULL;
+    }
+  else
+    g_array_sort (curve, curve_point_compare);
+
+  g_strfreev (points);
+  return curve;
+}
+
+
 gboolean parse_config (GromitData *data)
 {
   gboolean status = FALSE;
@@ -171,6 +230,9 @@ gboolean parse_config (GromitData *data)
   gfloat arrowsize;
   guint minlen, maxangle, radius, simplify, snapdist;
   GromitArrowType arrowtype;
+  /* owned here until the tool is defined, freed under cleanup otherwise */
+  gchar *image = NULL;
+  GArray *curve = NULL;
 
   /* try user config location */
   filename = g_strjoin (G_DIR_SEPARATOR_S,
@@ -221,6 +283,14 @@ gboolean parse_config (GromitData *data)
   g_scanner_scope_add_symbol (scanner, 0, "ERASER",    (gpointer) GROMIT_ERASER);
   g_scanner_scope_add_symbol (scanner, 0, "RECOLOR",   (gpointer) GROMIT_RECOLOR);
   g_scanner_scope_add_symbol (scanner, 0, "CIRCLE",    (gpointer) GROMIT_CIRCLE);
+  g_scanner_scope_add_symbol (scanner, 0, "LASER",     (gpointer) GROMIT_LASER);
+  g_scanner_scope_add_symbol (scanner, 0, "HIGHLIGHT", (gpointer) GROMIT_HIGHLIGHT);
+  g_scanner_scope_add_symbol (scanner, 0, "SPOTLIGHT", (gpointer) GROMIT_SPOTLIGHT);
+  g_scanner_scope_add_symbol (scanner, 0, "LENS",      (gpointer) GROMIT_LENS);
+  g_scanner_scope_add_symbol (scanner, 0, "FILL",      (gpointer) GROMIT_FILL);
+  g_scanner_scope_add_symbol (scanner, 0, "LASSO",     (gpointer) GROMIT_LASSO);
+  g_scanner_scope_add_symbol (scanner, 0, "TEXT",      (gpointer) GROMIT_TEXT);
+  g_scanner_scope_add_symbol (scanner, 0, "STAMP",     (gpointer) GROMIT_STAMP);
   g_scanner_scope_add_symbol (scanner, 0, "HOTKEY",               HOTKEY_SYMBOL_VALUE);
   g_scanner_scope_add_symbol (scanner, 0, "UNDOKEY",              UNDOKEY_SYMBOL_VALUE);
 
@@ -245,9 +315,21 @@ gboolean parse_config (GromitData *data)
   g_scanner_scope_add_symbol (scanner, 2, "minlen",    (gpointer) SYM_MINLEN);
   g_scanner_scope_add_symbol (scanner, 2, "simplify",  (gpointer) SYM_SIMPLIFY);
   g_scanner_scope_add_symbol (scanner, 2, "snap",      (gpointer) SYM_SNAP);
+  g_scanner_scope_add_symbol (scanner, 2, "stabilize", (gpointer) SYM_STABILIZE);
+  g_scanner_scope_add_symbol (scanner, 2, "stabilizebeta", (gpointer) SYM_STABILIZEBETA);
+  g_scanner_scope_add_symbol (scanner, 2, "gamma",     (gpointer) SYM_GAMMA);
+  g_scanner_scope_add_symbol (scanner, 2, "curve",     (gpointer) SYM_CURVE);
+  g_scanner_scope_add_symbol (scanner, 2, "tilt",      (gpointer) SYM_TILT);
   g_scanner_scope_add_symbol (scanner, 2, "fillcolor", (gpointer) SYM_FILLCOLOR);
   g_scanner_scope_add_symbol (scanner, 2, "textsize",  (gpointer) SYM_TEXTSIZE);
   g_scanner_scope_add_symbol (scanner, 2, "showlength",(gpointer) SYM_SHOWLENGTH);
+  g_scanner_scope_add_symbol (scanner, 2, "fade",      (gpointer) SYM_FADE);
+  g_scanner_scope_add_symbol (scanner, 2, "shape",     (gpointer) SYM_SHAPE);
+  g_scanner_scope_add_symbol (scanner, 2, "zoom",      (gpointer) SYM_ZOOM);
+  g_scanner_scope_add_symbol (scanner, 2, "recognize", (gpointer) SYM_RECOGNIZE);
+  g_scanner_scope_add_symbol (scanner, 2, "image",     (gpointer) SYM_IMAGE);
+  g_scanner_scope_add_symbol (scanner, 2, "predict",   (gpointer) SYM_PREDICT);
+  g_scanner_scope_add_symbol (scanner, 2, "predictsamples", (gpointer) SYM_PREDICTSAMPLES);
 
   g_scanner_set_scope (scanner, 0);
   scanner->config->scope_0_fallback = 0;
@@ -291,10 +373,23 @@ gboolean parse_config (GromitData *data)
           maxangle = 15;
           simplify = 10;
           snapdist = 0;
+          gfloat stabilize = 0;
+          gfloat stabilize_beta = 0.007;
+          gfloat gamma = 1.0;
+          curve = NULL;
+          gfloat tilt = 0;
           fill_color = NULL;
           fg_color = data->red;
           gfloat textsize = 14.0;
           gboolean showlength = 0;
+          gfloat fade = 2.0;
+          gboolean spot_rect = FALSE;
+          gfloat zoom = 2.0;
+          gboolean has_zoom = FALSE;
+          gfloat recognize = 0;
+          image = NULL;
+          guint predict = 0;
+          guint predict_samples = 4;
 
           if (token == G_TOKEN_SYMBOL)
             {
@@ -319,12 +414,30 @@ gboolean parse_config (GromitData *data)
                   minlen = context_template->minlen;
                   maxangle = context_template->maxangle;
                   snapdist = context_template->snapdist;
+                  stabilize = context_template->stabilize;
+                  stabilize_beta = context_template->stabilize_beta;
+                  gamma = context_template->gamma;
+                  if (context_template->curve)
+                    {
+                      curve = g_array_new (FALSE, FALSE, sizeof (GromitCurvePoint));
+                      g_array_append_vals (curve, context_template->curve->data,
+                                           context_template->curve->len);
+                    }
+                  tilt = context_template->tilt;
                   minwidth = context_template->minwidth;
 		          maxwidth = context_template->maxwidth;
                   fill_color = context_template->fill_color;
                   fg_color = context_template->paint_color;
                   textsize = context_template->textsize;
                   showlength = context_template->showlength;
+                  fade = context_template->fade;
+                  spot_rect = context_template->spot_rect;
+                  zoom = context_template->zoom;
+                  has_zoom = TRUE;
+                  recognize = context_template->recognize;
+                  image = g_strdup (context_template->image);
+                  predict = context_template->predict;
+                  predict_samples = context_template->predict_samples;
                 }
               else
                 {
@@ -463,6 +576,57 @@ gboolean parse_config (GromitData *data)
                           if (isnan(v)) goto cleanup;
                           snapdist = v;
                         }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_STABILIZE)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing stabilizer cutoff (float)");
+                          if (isnan(v)) goto cleanup;
+                          if (v < 0) v = 0;
+                          stabilize = v;
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_STABILIZEBETA)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing stabilizer beta (float)");
+                          if (isnan(v)) goto cleanup;
+                          if (v < 0) v = 0;
+                          stabilize_beta = v;
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_GAMMA)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing pressure gamma (float)");
+                          if (isnan(v)) goto cleanup;
+                          gamma = CLAMP (v, 0.05, 20);
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_CURVE)
+                        {
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_EQUAL_SIGN)
+                            {
+                              g_printerr ("Missing \"=\"... aborting\n");
+                              goto cleanup;
+                            }
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_STRING)
+                            {
+                              g_printerr ("Missing pressure curve (string)... "
+                                          "aborting\n");
+                              goto cleanup;
+                            }
+                          if (curve)
+                            g_array_free (curve, TRUE);
+                          curve = parse_curve (scanner->value.v_string);
+                          if (!curve)
+                            {
+                              g_printerr ("Pressure curve must be pairs of pressure and "
+                                          "response between 0 and 1... aborting\n");
+                              goto cleanup;
+                            }
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_TILT)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing tilt widening (float)");
+                          if (isnan(v)) goto cleanup;
+                          tilt = v;
+                        }
                       else if ((intptr_t) scanner->value.v_symbol == SYM_FILLCOLOR)
                         {
                           token = g_scanner_get_next_token (scanner);
@@ -498,6 +662,94 @@ gboolean parse_config (GromitData *data)
                       else if ((intptr_t) scanner->value.v_symbol == SYM_SHOWLENGTH)
                         {
                           showlength = 1;
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_FADE)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing fade time (float)");
+                          if (isnan(v)) goto cleanup;
+                          if (v < 0) v = 0;
+                          fade = v;
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_ZOOM)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing zoom factor (float)");
+                          if (isnan(v)) goto cleanup;
+                          /* LENS magnifies at least 1x, a STAMP may shrink */
+                          if (v < 0.05) v = 0.05;
+                          zoom = v;
+                          has_zoom = TRUE;
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_RECOGNIZE)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing recognize tolerance (float)");
+                          if (isnan(v)) goto cleanup;
+                          if (v < 0) v = 0;
+                          recognize = v;
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_PREDICT)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing prediction time (float)");
+                          if (isnan(v)) goto cleanup;
+                          if (v < 0) v = 0;
+                          predict = v;
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_PREDICTSAMPLES)
+                        {
+                          gfloat v = parse_get_float(scanner, "Missing number of samples (float)");
+                          if (isnan(v)) goto cleanup;
+                          predict_samples = CLAMP (v, 2, GROMIT_PREDICT_MAX_SAMPLES);
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_IMAGE)
+                        {
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_EQUAL_SIGN)
+                            {
+                              g_printerr ("Missing \"=\"... aborting\n");
+                              goto cleanup;
+                            }
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_STRING)
+                            {
+                              g_printerr ("Missing image file name (string)... "
+                                          "aborting\n");
+                              goto cleanup;
+                            }
+                          g_free (image);
+                          /* relative to the config file */
+                          if (g_path_is_absolute (scanner->value.v_string))
+                            image = g_strdup (scanner->value.v_string);
+                          else
+                            {
+                              gchar *dir = g_path_get_dirname (filename);
+                              image = g_build_filename (dir, scanner->value.v_string, NULL);
+                              g_free (dir);
+                            }
+                        }
+                      else if ((intptr_t) scanner->value.v_symbol == SYM_SHAPE)
+                        {
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_EQUAL_SIGN)
+                            {
+                              g_printerr ("Missing \"=\"... aborting\n");
+                              goto cleanup;
+                            }
+                          token = g_scanner_get_next_token (scanner);
+                          if (token != G_TOKEN_STRING)
+                            {
+                              g_printerr ("Missing shape (string)... "
+                                          "aborting\n");
+                              goto cleanup;
+                            }
+                          if (! strcasecmp(scanner->value.v_string, "circle"))
+                            spot_rect = FALSE;
+                          else if (! strcasecmp(scanner->value.v_string, "rect"))
+                            spot_rect = TRUE;
+                          else
+                            {
+                              g_printerr ("Shape must be \"circle\" or \"rect\"... "
+                                          "aborting\n");
+                              goto cleanup;
+                            }
                         }
 		              else
                         {
@@ -529,8 +781,28 @@ gboolean parse_config (GromitData *data)
                                        simplify, radius, maxangle, minlen, snapdist,
                                        minwidth, maxwidth);
           context->fill_color = fill_color;
+          context->stabilize = stabilize;
+          context->stabilize_beta = stabilize_beta;
+          context->gamma = gamma;
+          context->curve = curve;
+          curve = NULL;
+          context->tilt = tilt;
+          /* with the widths and the curve known */
+          paint_context_pressure_lut (context);
           context->textsize = textsize;
           context->showlength = showlength;
+          context->fade = fade;
+          context->spot_rect = spot_rect;
+          /* stamps are shown as they are unless zoomed */
+          context->zoom = (type == GROMIT_STAMP && !has_zoom) ? 1.0 : zoom;
+          context->recognize = recognize;
+          context->image = image;
+          image = NULL;
+          context->predict = predict;
+          context->predict_samples = predict_samples;
+          /* decode stamps now rather than on the first click */
+          if (type == GROMIT_STAMP && context->image)
+            stamp_load (data, context->image);
           g_hash_table_insert (data->tool_config, name, context);
         }
       else if (token == G_TOKEN_SYMBOL &&
@@ -590,6 +862,10 @@ gboolean parse_config (GromitData *data)
 
  cleanup:
 
+  g_free (image);
+  if (curve)
+    g_array_free (curve, TRUE);
+
   if (!status) {
       /* purge incomplete tool config */
       GHashTableIter it;
@@ -684,6 +960,14 @@ int parse_args (int argc, char **argv, GromitData *data)
                wrong_arg = TRUE;
              }
          }
+       else if (strcmp (arg, "--xshm") == 0)
+         {
+           data->xshm = TRUE;
+         }
+       else if (strcmp (arg, "--no-xshm") == 0)
+         {
+           data->xshm = FALSE;
+         }
        else if (strcmp (arg, "-u") == 0 ||
                 strcmp (arg, "--undo-key") == 0)
          {
@@ -766,6 +1050,8 @@ void read_keyfile(GromitData *data)
     // 0.0 on not-found, but anyway, also don't use 0.0 when user-set
     if(data->opacity == 0)
 	data->opacity = DEFAULT_OPACITY;
+    data->xshm = g_key_file_get_boolean (key_file, "Drawing", "XShm", NULL);
+    data->scale_setting = g_key_file_get_integer (key_file, "Drawing", "Scale", NULL);
 
  cleanup:
     g_free(filename);
@@ -783,6 +1069,8 @@ void write_keyfile(GromitData *data)
 
     g_key_file_set_boolean (key_file, "General", "ShowIntroOnStartup", data->show_intro_on_startup);
     g_key_file_set_double (key_file, "Drawing", "Opacity", data->opacity);
+    g_key_file_set_boolean (key_file, "Drawing", "XShm", data->xshm);
+    g_key_file_set_integer (key_file, "Drawing", "Scale", data->scale_setting);
 
     // if file exists but is read-only, bail out
     if (access(filename, F_OK) == 0 && access(filename, W_OK) != 0) {
@@ -153,8 +153,8 @@ static xy get_xy_from_coord(GList *ptr) {
 
 static void set_coord_from_xy(xy *point, GList *ptr) {
     GromitStrokeCoordinate *coord = ptr->data;
-    coord->x = point->x + 0.5;
-    coord->y = point->y + 0.5;
+    coord->x = point->x;
+    coord->y = point->y;
 }
 
 static xy xy_vec_from_coords(GList *start, GList *end) {
@@ -321,8 +321,8 @@ static void apply2D_coords(GList *start, GList *end, trans2D *m) {
     while (start) {
         GromitStrokeCoordinate *ptr = start->data;
         gfloat newx = m->m_11 * ptr->x + m->m_12 * ptr->y + m->m_13;
-        ptr->y = m->m_21 * ptr->x + m->m_22 * ptr->y + m->m_23 + 0.5;
-        ptr->x = newx + 0.5;
+        ptr->y = m->m_21 * ptr->x + m->m_22 * ptr->y + m->m_23;
+        ptr->x = newx;
         if (start == end) break;
         start = start->next;
     }
@@ -461,9 +461,9 @@ static GList *build_section_list(GList *const coords,
 
 void coord_list_prepend (GromitData *data, 
 			 GdkDevice* dev, 
-			 gint x, 
-			 gint y, 
-			 gint width)
+			 gfloat x, 
+			 gfloat y, 
+			 gfloat width)
 {
   /* get the data for this device */
   GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
@@ -507,12 +507,12 @@ gboolean coord_list_get_arrow_param (GromitData      *data,
 				     GdkDevice       *dev,
 				     gint            search_radius,
                                      GromitArrowType arrow_end,
-                                     gint            *x0,
-                                     gint            *y0,
-				     gint            *ret_width,
+                                     gfloat          *x0,
+                                     gfloat          *y0,
+				     gfloat          *ret_width,
 				     gfloat          *ret_direction)
 {
-  gint r2, dist;
+  gfloat r2, dist;
   gboolean success = FALSE;
   GromitStrokeCoordinate  *cur_point, *valid_point;
   /* get the data for this device */
@@ -722,8 +722,8 @@ void add_points(GList *coords, gfloat max_distance) {
                 GromitStrokeCoordinate *new_coord =
                     g_malloc(sizeof(GromitStrokeCoordinate));
                 new_coord->width = p0->width;
-                new_coord->x = p0->x + (p1->x - p0->x) * k + 0.5;
-                new_coord->y = p0->y + (p1->y - p0->y) * k + 0.5;
+                new_coord->x = p0->x + (p1->x - p0->x) * k;
+                new_coord->y = p0->y + (p1->y - p0->y) * k;
                 GList *tmp = g_list_insert_before(coords, ptr->next, new_coord);
                 assert(tmp == coords);
             }
@@ -739,7 +739,7 @@ void round_corners(GList *coords, gint radius, gint steps, gboolean circular) {
     GList *ptr = coords;
     if (ptr && g_list_length(ptr) > 2) {
         gfloat prev_len, next_len;
-        const gint width = ((GromitStrokeCoordinate *)ptr->data)->width;
+        const gfloat width = ((GromitStrokeCoordinate *)ptr->data)->width;
         for (;;) {
             gboolean is_last = (ptr->next == NULL);
             GList *next_pt = is_last ? coords->next : ptr->next;
@@ -938,7 +938,7 @@ GList *catmull_rom(GList *coords, gint steps, gboolean circular) {
 
     GList *result = NULL;  // interpolated coordinated
     GList *srcptr = coords;
-    gint width = ((GromitStrokeCoordinate *)coords->data)->width;
+    gfloat width = ((GromitStrokeCoordinate *)coords->data)->width;
 
     GList *p0 = NULL;  // first segment: p0 = NULL
     GList *p1 = srcptr;
@@ -1000,8 +1000,8 @@ GList *catmull_rom(GList *coords, gint steps, gboolean circular) {
 
             GromitStrokeCoordinate *coord = g_malloc(sizeof(GromitStrokeCoordinate));
             coord->width = width;
-            coord->x = pt.x + 0.5;
-            coord->y = pt.y + 0.5;
+            coord->x = pt.x;
+            coord->y = pt.y;
 
             result = g_list_append(result, coord);
         }
@@ -1015,3 +1015,455 @@ GList *catmull_rom(GList *coords, gint steps, gboolean circular) {
     g_list_free_full(coords, g_free);
     return result;
 }
+
+// ------------------------ shape recognition ------------------------
+//
+// All fits are closed form: sums over the points are gathered in one
+// pass and a small linear system or 2x2 eigenproblem gives the shape.
+// Residuals are RMS distances in pixels, recognize_shape() relates them
+// to the diagonal of the bounding box so all shapes share one scale.
+
+typedef struct {
+    guint n;
+    gdouble mx, my;     // mean
+    gdouble sxx, syy, sxy;  // central second moments
+    gfloat width;       // mean line width
+    gfloat minx, miny, maxx, maxy;
+} ShapeStats;
+
+// of the first n points of coords, or all of them if there are fewer
+static void shape_stats(GList *coords, guint n, ShapeStats *st) {
+    gdouble sx = 0, sy = 0, sw = 0;
+    GList *ptr;
+    guint i;
+
+    memset(st, 0, sizeof(ShapeStats));
+    st->minx = st->miny = G_MAXFLOAT;
+    st->maxx = st->maxy = -G_MAXFLOAT;
+
+    for (ptr = coords; ptr && st->n < n; ptr = ptr->next) {
+        GromitStrokeCoordinate *c = ptr->data;
+        sx += c->x;
+        sy += c->y;
+        sw += c->width;
+        st->minx = MIN(st->minx, c->x);
+        st->miny = MIN(st->miny, c->y);
+        st->maxx = MAX(st->maxx, c->x);
+        st->maxy = MAX(st->maxy, c->y);
+        st->n++;
+    }
+    st->mx = sx / st->n;
+    st->my = sy / st->n;
+    st->width = sw / st->n;
+
+    for (ptr = coords, i = 0; i < st->n; ptr = ptr->next, i++) {
+        GromitStrokeCoordinate *c = ptr->data;
+        gdouble dx = c->x - st->mx, dy = c->y - st->my;
+        st->sxx += dx * dx;
+        st->syy += dy * dy;
+        st->sxy += dx * dy;
+    }
+    st->sxx /= st->n;
+    st->syy /= st->n;
+    st->sxy /= st->n;
+}
+
+/*
+ * eigenvalues l1 >= l2 of the covariance and the angle of the major axis
+ */
+static void shape_axes(ShapeStats *st, gdouble *l1, gdouble *l2, gdouble *angle) {
+    gdouble h = (st->sxx + st->syy) / 2;
+    gdouble d = sqrt(square((st->sxx - st->syy) / 2) + st->sxy * st->sxy);
+    *l1 = h + d;
+    *l2 = MAX(h - d, 0);
+    *angle = 0.5 * atan2(2 * st->sxy, st->sxx - st->syy);
+}
+
+static GList *shape_point(GList *list, gdouble x, gdouble y, gfloat width) {
+    GromitStrokeCoordinate *c = g_malloc(sizeof(GromitStrokeCoordinate));
+    c->x = x;
+    c->y = y;
+    c->width = width;
+    return g_list_prepend(list, c);
+}
+
+/*
+ * total least squares line through the st->n points from coords on,
+ * from the first to the last of them, residual is the RMS distance to it
+ */
+static gdouble fit_line(GList *coords, ShapeStats *st, xy *p0, xy *p1) {
+    gdouble l1, l2, angle;
+    shape_axes(st, &l1, &l2, &angle);
+
+    gdouble ux = cos(angle), uy = sin(angle);
+    GromitStrokeCoordinate *first = coords->data;
+    GromitStrokeCoordinate *last = g_list_nth_data(coords, st->n - 1);
+    gdouble t0 = (first->x - st->mx) * ux + (first->y - st->my) * uy;
+    gdouble t1 = (last->x - st->mx) * ux + (last->y - st->my) * uy;
+
+    p0->x = st->mx + t0 * ux;
+    p0->y = st->my + t0 * uy;
+    p1->x = st->mx + t1 * ux;
+    p1->y = st->my + t1 * uy;
+
+    gdouble len = fabs(t1 - t0);
+    return len > 0 ? sqrt(l2) : G_MAXDOUBLE;
+}
+
+/*
+ * algebraic (Kasa) circle fit, residual is the RMS radial distance
+ */
+static gdouble fit_circle(GList *coords, ShapeStats *st, xy *center, gdouble *radius) {
+    gdouble suu = 0, svv = 0, suv = 0, suuu = 0, svvv = 0, suvv = 0, svuu = 0;
+    GList *ptr;
+
+    for (ptr = coords; ptr; ptr = ptr->next) {
+        GromitStrokeCoordinate *c = ptr->data;
+        gdouble u = c->x - st->mx, v = c->y - st->my;
+        suu += u * u;
+        svv += v * v;
+        suv += u * v;
+        suuu += u * u * u;
+        svvv += v * v * v;
+        suvv += u * v * v;
+        svuu += v * u * u;
+    }
+
+    gdouble det = suu * svv - suv * suv;
+    if (fabs(det) < 1e-9)
+        return G_MAXDOUBLE;
+
+    gdouble bu = 0.5 * (suuu + suvv), bv = 0.5 * (svvv + svuu);
+    gdouble uc = (bu * svv - bv * suv) / det;
+    gdouble vc = (bv * suu - bu * suv) / det;
+    *radius = sqrt(uc * uc + vc * vc + (suu + svv) / st->n);
+    center->x = st->mx + uc;
+    center->y = st->my + vc;
+
+    gdouble err = 0;
+    for (ptr = coords; ptr; ptr = ptr->next) {
+        GromitStrokeCoordinate *c = ptr->data;
+        gdouble d = hypot(c->x - center->x, c->y - center->y) - *radius;
+        err += d * d;
+    }
+    return sqrt(err / st->n);
+}
+
+/*
+ * ellipse from the second moments of the outline, residual is the RMS
+ * distance to it along the ray from the center
+ */
+static gdouble fit_ellipse(GList *coords, ShapeStats *st, gdouble *a, gdouble *b, gdouble *angle) {
+    gdouble l1, l2;
+    GList *ptr;
+
+    shape_axes(st, &l1, &l2, angle);
+    // a point running around an ellipse has a variance of half its squared semi-axes
+    *a = sqrt(2 * l1);
+    *b = sqrt(2 * l2);
+    if (*b < 1)
+        return G_MAXDOUBLE;
+
+    gdouble ca = cos(*angle), sa = sin(*angle), err = 0;
+    for (ptr = coords; ptr; ptr = ptr->next) {
+        GromitStrokeCoordinate *c = ptr->data;
+        gdouble dx = c->x - st->mx, dy = c->y - st->my;
+        gdouble u = dx * ca + dy * sa, v = -dx * sa + dy * ca;
+        gdouble rho = sqrt(square(u / *a) + square(v / *b));
+        // the ray meets the outline at (u,v)/rho
+        gdouble d = rho > 1e-6 ? fabs(rho - 1) / rho * hypot(u, v) : *b;
+        err += d * d;
+    }
+    return sqrt(err / st->n);
+}
+
+// corners are found on a copy thinned to this many points, the
+// residuals still use all of them
+#define SHAPE_MAX_CORNER_POINTS 512
+
+/*
+ * copy of every k-th point of the n in 'coords' so that at most
+ * SHAPE_MAX_CORNER_POINTS remain, always including the last one. The
+ * width of each copied point is its index in 'coords'.
+ */
+static GList *copy_coords(GList *coords, guint n) {
+    GList *copy = NULL, *ptr;
+    guint step = (n + SHAPE_MAX_CORNER_POINTS - 1) / SHAPE_MAX_CORNER_POINTS, i = 0;
+    for (ptr = g_list_last(coords); ptr; ptr = ptr->prev, i++) {
+        if (i % step != 0 && ptr->prev)
+            continue;
+        GromitStrokeCoordinate *c = g_malloc(sizeof(GromitStrokeCoordinate));
+        *c = *(GromitStrokeCoordinate *)ptr->data;
+        c->width = n - 1 - i;
+        copy = g_list_prepend(copy, c);
+    }
+    return copy;
+}
+
+static gdouble xy_angle_between(xy *a, xy *b) {
+    gdouble d = (a->x * b->x + a->y * b->y) / (xy_length(a) * xy_length(b));
+    return acos(CLAMP(d, -1, 1));
+}
+
+/*
+ * Rectangle from the four corners Douglas-Peucker leaves of a closed
+ * stroke. Its orientation is the mean of the side directions, its
+ * extent the mean of opposite sides. Residual is the RMS distance to
+ * the outline.
+ */
+static gdouble fit_rect(GList *coords, ShapeStats *st, xy corners[4]) {
+    GList *copy = copy_coords(coords, st->n), *ptr;
+    xy p[7], *c;
+    gint i, n = 0;
+
+    gdouble diag = hypot(st->maxx - st->minx, st->maxy - st->miny);
+    douglas_peucker(copy, MAX(3, 0.06 * diag));
+    for (ptr = copy; ptr && n < 7; ptr = ptr->next)
+        p[n++] = get_xy_from_coord(ptr);
+    g_list_free_full(copy, g_free);
+
+    // started at a corner, or somewhere along a side
+    if (n == 5)
+        c = p;
+    else if (n == 6)
+        c = p + 1;
+    else
+        return G_MAXDOUBLE;
+
+    // all corners about right angles
+    for (i = 0; i < 4; i++) {
+        xy in = xy_vec(&c[(i + 3) % 4], &c[i]);
+        xy out = xy_vec(&c[i], &c[(i + 1) % 4]);
+        if (fabs(xy_angle_between(&in, &out) - M_PI / 2) > M_PI / 9)
+            return G_MAXDOUBLE;
+    }
+
+    // mean direction of the sides, modulo 90 degrees via angle quadrupling
+    gdouble ssin = 0, scos = 0;
+    for (i = 0; i < 4; i++) {
+        xy side = xy_vec(&c[i], &c[(i + 1) % 4]);
+        gdouble a = 4 * atan2(side.y, side.x);
+        ssin += sin(a);
+        scos += cos(a);
+    }
+    gdouble angle = atan2(ssin, scos) / 4;
+    gdouble ux = cos(angle), uy = sin(angle);
+
+    // extent along both axes from the corners projected onto them
+    gdouble mx = 0, my = 0;
+    for (i = 0; i < 4; i++) {
+        mx += c[i].x / 4;
+        my += c[i].y / 4;
+    }
+    gdouble hu = 0, hv = 0;
+    for (i = 0; i < 4; i++) {
+        hu += fabs((c[i].x - mx) * ux + (c[i].y - my) * uy) / 4;
+        hv += fabs(-(c[i].x - mx) * uy + (c[i].y - my) * ux) / 4;
+    }
+
+    gdouble err = 0;
+    for (ptr = coords; ptr; ptr = ptr->next) {
+        GromitStrokeCoordinate *p = ptr->data;
+        gdouble u = fabs((p->x - mx) * ux + (p->y - my) * uy);
+        gdouble v = fabs(-(p->x - mx) * uy + (p->y - my) * ux);
+        // distance to the outline from inside or outside
+        gdouble d = (u <= hu && v <= hv) ? MIN(hu - u, hv - v)
+                                         : hypot(MAX(u - hu, 0), MAX(v - hv, 0));
+        err += d * d;
+    }
+
+    const gint su[4] = { -1, 1, 1, -1 }, sv[4] = { -1, -1, 1, 1 };
+    for (i = 0; i < 4; i++) {
+        corners[i].x = mx + su[i] * hu * ux - sv[i] * hv * uy;
+        corners[i].y = my + su[i] * hu * uy + sv[i] * hv * ux;
+    }
+    return sqrt(err / st->n);
+}
+
+/*
+ * A one-stroke arrow is a shaft, one barb, back to the tip and the other
+ * barb: five points after simplification, the tip at either end of the
+ * list depending on the drawing direction. If they are laid out like
+ * that, the four runs of points between them are fitted as lines, which
+ * give the shaft and the barb length, and the RMS distance of all points
+ * to them is returned. G_MAXDOUBLE if it is no arrow.
+ */
+static gdouble fit_arrow(GList *coords, ShapeStats *st, xy *start, xy *tip, gdouble *head) {
+    GList *copy = copy_coords(coords, st->n), *ptr;
+    xy c[6];
+    guint idx[6];
+    gint n = 0, k, j;
+
+    gdouble diag = hypot(st->maxx - st->minx, st->maxy - st->miny);
+    douglas_peucker(copy, MAX(3, 0.04 * diag));
+    for (ptr = copy; ptr && n < 6; ptr = ptr->next) {
+        idx[n] = ((GromitStrokeCoordinate *)ptr->data)->width;
+        c[n++] = get_xy_from_coord(ptr);
+    }
+    g_list_free_full(copy, g_free);
+    if (n != 5)
+        return G_MAXDOUBLE;
+
+    for (k = 0; k < 2; k++) {
+        // k == 1: the shaft starts at the end of the list
+        xy s = c[k ? 4 : 0], t = c[k ? 3 : 1], b1 = c[2], t2 = c[k ? 1 : 3], b2 = c[k ? 0 : 4];
+        xy shaft = xy_vec(&t, &s);
+        xy barb1 = xy_vec(&t, &b1), barb2 = xy_vec(&t2, &b2);
+        gdouble len = xy_length(&shaft);
+        gdouble l1 = xy_length(&barb1), l2 = xy_length(&barb2);
+        xy gap = xy_vec(&t, &t2);
+
+        if (l1 > 0.5 * len || l2 > 0.5 * len || l1 < 0.05 * len || l2 < 0.05 * len ||
+            xy_length(&gap) > 0.5 * MIN(l1, l2))
+            continue;
+
+        gdouble a1 = xy_angle_between(&shaft, &barb1), a2 = xy_angle_between(&shaft, &barb2);
+        gdouble side1 = shaft.x * barb1.y - shaft.y * barb1.x;
+        gdouble side2 = shaft.x * barb2.y - shaft.y * barb2.x;
+        if (a1 < M_PI / 18 || a1 > M_PI * 7 / 18 || a2 < M_PI / 18 || a2 > M_PI * 7 / 18 ||
+            side1 * side2 >= 0)
+            continue;
+
+        // in list order, the shaft is the first or the last run
+        gdouble err = 0, barbs = 0;
+        guint total = 0;
+        ptr = coords;
+        for (j = 0; j < 4; j++) {
+            ShapeStats run;
+            xy p0, p1;
+            shape_stats(ptr, idx[j + 1] - idx[j] + 1, &run);
+            gdouble e = fit_line(ptr, &run, &p0, &p1);
+            if (e == G_MAXDOUBLE)
+                return G_MAXDOUBLE;
+            err += run.n * e * e;
+            total += run.n;
+            if (j == (k ? 3 : 0)) {
+                *start = k ? p1 : p0;
+                *tip = k ? p0 : p1;
+            } else {
+                xy barb = xy_vec(&p0, &p1);
+                barbs += xy_length(&barb) / 3;
+            }
+            ptr = g_list_nth(ptr, idx[j + 1] - idx[j]);
+        }
+        *head = barbs;
+        return sqrt(err / total);
+    }
+    return G_MAXDOUBLE;
+}
+
+/*
+ * Tries to recognise a line, arrow, circle, ellipse or rectangle in the
+ * stroke. If one fits with a residual below 'tolerance' times the
+ * diagonal of the bounding box, the coordinates are replaced by the
+ * clean outline and its type returned.
+ * For arrows only the shaft is returned, ending at the tip, with the
+ * barb length in 'head'.
+ */
+GromitShapeType recognize_shape(GList **coords, gfloat tolerance, gfloat *head) {
+    ShapeStats st;
+    GList *result = NULL;
+    GromitShapeType type = GROMIT_SHAPE_NONE;
+    gint i;
+
+    if (g_list_length(*coords) < 5)
+        return GROMIT_SHAPE_NONE;
+
+    shape_stats(*coords, G_MAXUINT, &st);
+    gdouble size = MAX(st.maxx - st.minx, st.maxy - st.miny);
+    if (size < 10)
+        return GROMIT_SHAPE_NONE;
+
+    GromitStrokeCoordinate *first = (*coords)->data;
+    GromitStrokeCoordinate *last = g_list_last(*coords)->data;
+    gboolean closed = hypot(first->x - last->x, first->y - last->y) < 0.2 * size;
+    gdouble diag = hypot(st.maxx - st.minx, st.maxy - st.miny);
+
+    if (!closed) {
+        xy p0, p1;
+        gdouble h;
+        // the arrow first, its short barbs barely disturb a line fit
+        if (fit_arrow(*coords, &st, &p0, &p1, &h) / diag < tolerance) {
+            // the tip ends the list like the newest point of a stroke
+            result = shape_point(shape_point(NULL, p0.x, p0.y, st.width), p1.x, p1.y, st.width);
+            *head = h;
+            type = GROMIT_SHAPE_ARROW;
+        } else if (fit_line(*coords, &st, &p0, &p1) / diag < tolerance) {
+            result = shape_point(shape_point(NULL, p1.x, p1.y, st.width), p0.x, p0.y, st.width);
+            type = GROMIT_SHAPE_LINE;
+        }
+    } else {
+        xy center, corners[4];
+        gdouble r, a, b, angle;
+        gdouble e_circle = fit_circle(*coords, &st, &center, &r) / diag;
+        gdouble e_ellipse = fit_ellipse(*coords, &st, &a, &b, &angle) / diag;
+        gdouble e_rect = fit_rect(*coords, &st, corners) / diag;
+        gint steps = 64;
+
+        if (e_rect < tolerance && e_rect <= MIN(e_circle, e_ellipse)) {
+            for (i = 0; i <= 4; i++)
+                result = shape_point(result, corners[i % 4].x, corners[i % 4].y, st.width);
+            type = GROMIT_SHAPE_RECT;
+        } else if (e_circle < tolerance && e_circle <= e_ellipse * 1.2) {
+            for (i = 0; i <= steps; i++)
+                result = shape_point(result, center.x + r * cos(2 * M_PI * i / steps),
+                                     center.y + r * sin(2 * M_PI * i / steps), st.width);
+            type = GROMIT_SHAPE_CIRCLE;
+        } else if (e_ellipse < tolerance) {
+            gdouble ca = cos(angle), sa = sin(angle);
+            for (i = 0; i <= steps; i++) {
+                gdouble u = a * cos(2 * M_PI * i / steps), v = b * sin(2 * M_PI * i / steps);
+                result = shape_point(result, st.mx + u * ca - v * sa, st.my + u * sa + v * ca, st.width);
+            }
+            type = GROMIT_SHAPE_ELLIPSE;
+        }
+    }
+
+    if (type != GROMIT_SHAPE_NONE) {
+        g_list_free_full(*coords, g_free);
+        *coords = result;
+    }
+    return type;
+}
+
+// ======================== stroke stabilizer ========================
+
+/*
+ * restart the stabilizer at (x,y), e.g. when the button goes down
+ */
+void stabilizer_reset(GromitStabilizer *st, gdouble x, gdouble y, guint32 time) {
+    st->x = x;
+    st->y = y;
+    st->dx = st->dy = 0;
+    st->time = time;
+}
+
+// smoothing factor of an exponential low pass with the given cutoff
+static gdouble one_euro_alpha(gdouble cutoff, gdouble te) {
+    gdouble tau = 1.0 / (2 * M_PI * cutoff);
+    return 1.0 / (1.0 + tau / te);
+}
+
+/*
+ * One-Euro filter (Casiez et al., CHI 2012): a low pass whose cutoff
+ * rises with the speed, so slow strokes lose their jitter while fast
+ * ones keep up with the pointer. Replaces (x,y) by the filtered sample.
+ */
+void stabilizer_filter(GromitStabilizer *st, gfloat mincutoff, gfloat beta,
+                       gdouble *x, gdouble *y, guint32 time) {
+    const gdouble dcutoff = 1.0;  // Hz, for the speed estimate
+    // events of one timestamp are a millisecond apart at least
+    gdouble te = MAX((gint32)(time - st->time), 1) / 1000.0;
+
+    gdouble a = one_euro_alpha(dcutoff, te);
+    st->dx += a * ((*x - st->x) / te - st->dx);
+    st->dy += a * ((*y - st->y) / te - st->dy);
+
+    a = one_euro_alpha(mincutoff + beta * hypot(st->dx, st->dy), te);
+    st->x += a * (*x - st->x);
+    st->y += a * (*y - st->y);
+    st->time = time;
+
+    *x = st->x;
+    *y = st->y;
+}
@@ -31,11 +31,11 @@ gboolean coord_list_get_arrow_param (GromitData *data,
 				     GdkDevice  *dev,
 				     gint        search_radius,
                                      GromitArrowType arrow_end,
-                                     gint       *x0,
-                                     gint       *y0,
-				     gint       *ret_width,
+                                     gfloat     *x0,
+                                     gfloat     *y0,
+				     gfloat     *ret_width,
 				     gfloat     *ret_direction);
-void coord_list_prepend (GromitData *data, GdkDevice* dev, gint x, gint y, gint width);
+void coord_list_prepend (GromitData *data, GdkDevice* dev, gfloat x, gfloat y, gfloat width);
 void coord_list_free (GromitData *data, GdkDevice* dev);
 gboolean snap_ends(GList *coords, gint max_distance);
 void orthogonalize(GList *coords, gint max_angular_deviation, gint min_ortho_len);
@@ -43,5 +43,19 @@ void add_points(GList *coords, gfloat max_distance);
 void round_corners(GList *coords, gint radius, gint steps, gboolean circular);
 void douglas_peucker(GList *coords, gfloat epsilon);
 GList *catmull_rom(GList *coords, gint steps, gboolean circular);
+void stabilizer_reset(GromitStabilizer *st, gdouble x, gdouble y, guint32 time);
+void stabilizer_filter(GromitStabilizer *st, gfloat mincutoff, gfloat beta,
+                       gdouble *x, gdouble *y, guint32 time);
+
+typedef enum {
+    GROMIT_SHAPE_NONE,
+    GROMIT_SHAPE_LINE,
+    GROMIT_SHAPE_ARROW,
+    GROMIT_SHAPE_CIRCLE,
+    GROMIT_SHAPE_ELLIPSE,
+    GROMIT_SHAPE_RECT
+} GromitShapeType;
+
+GromitShapeType recognize_shape(GList **coords, gfloat tolerance, gfloat *head);
 
 #endif
@@ -1,62 +1,113 @@
 
 #include <math.h>
+#include <string.h>
 #include "drawing.h"
 #include "main.h"
+#include "undo.h"
+#include "brush.h"
+#include "predict.h"
+#include "stamp.h"
+
+
+/*
+ * the context and colour a device currently paints with
+ */
+static cairo_t *stroke_ctx (GromitData *data, GromitDeviceData *devdata)
+{
+  if (devdata->scratch_ctx)
+    return devdata->scratch_ctx;
+  return paint_context_cairo (data, devdata->cur_context);
+}
+
+static GdkRGBA *stroke_color (GromitDeviceData *devdata)
+{
+  if (devdata->scratch_ctx)
+    return &devdata->scratch_color;
+  return devdata->cur_context->paint_color;
+}
+
+static void scratch_reserve (GromitData *data, GromitDeviceData *devdata, GdkRectangle *rect);
+
+static void stroke_damage (GromitData *data,
+                           GromitDeviceData *devdata,
+                           GdkRectangle *rect)
+{
+  data->modified = 1;
+
+  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), rect, 0);
+
+  if (devdata->scratch_ctx)
+    {
+      if (devdata->scratch_rect.width > 0)
+        gdk_rectangle_union (&devdata->scratch_rect, rect, &devdata->scratch_rect);
+      else
+        devdata->scratch_rect = *rect;
+    }
+}
+
+static void paint_line (cairo_t *cr,
+                        gdouble x1, gdouble y1,
+                        gdouble x2, gdouble y2,
+                        gdouble width)
+{
+  cairo_set_line_width(cr, width);
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+
+  cairo_move_to(cr, x1, y1);
+  cairo_line_to(cr, x2, y2);
+  cairo_stroke(cr);
+}
+
 
 void draw_line (GromitData *data,
 		GdkDevice *dev,
-		gint x1, gint y1,
-		gint x2, gint y2)
+		gdouble x1, gdouble y1,
+		gdouble x2, gdouble y2)
 {
   GdkRectangle rect;
   GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
 
-  rect.x = MIN (x1,x2) - data->maxwidth / 2;
-  rect.y = MIN (y1,y2) - data->maxwidth / 2;
-  rect.width = ABS (x1-x2) + data->maxwidth;
-  rect.height = ABS (y1-y2) + data->maxwidth;
+  rect.x = floor (MIN (x1,x2) - data->maxwidth / 2.0) - 1;
+  rect.y = floor (MIN (y1,y2) - data->maxwidth / 2.0) - 1;
+  rect.width = ceil (MAX (x1,x2) + data->maxwidth / 2.0) + 1 - rect.x;
+  rect.height = ceil (MAX (y1,y2) + data->maxwidth / 2.0) + 1 - rect.y;
 
   if(data->debug)
-    g_printerr("DEBUG: draw line from %d %d to %d %d\n", x1, y1, x2, y2);
+    g_printerr("DEBUG: draw line from %.1f %.1f to %.1f %.1f\n", x1, y1, x2, y2);
 
-  if (devdata->cur_context->paint_ctx)
+  if (stroke_ctx (data, devdata))
     {
-      cairo_set_line_width(devdata->cur_context->paint_ctx, data->maxwidth);
-      cairo_set_line_cap(devdata->cur_context->paint_ctx, CAIRO_LINE_CAP_ROUND);
-      cairo_set_line_join(devdata->cur_context->paint_ctx, CAIRO_LINE_JOIN_ROUND);
- 
-      cairo_move_to(devdata->cur_context->paint_ctx, x1, y1);
-      cairo_line_to(devdata->cur_context->paint_ctx, x2, y2);
-      cairo_stroke(devdata->cur_context->paint_ctx);
+      scratch_reserve (data, devdata, &rect);
+      paint_line (stroke_ctx (data, devdata), x1, y1, x2, y2, data->maxwidth);
 
-      data->modified = 1;
+      stroke_damage (data, devdata, &rect);
 
-      gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+      if (devdata->cur_op)
+        undo_op_add_line (devdata->cur_op, x1, y1, x2, y2, data->maxwidth, &rect);
     }
 
   data->painted = 1;
 }
 
 
-void draw_arrow (GromitData *data, 
-		 GdkDevice *dev,
-		 gint x1, gint y1,
-		 gfloat width,
-		 gfloat direction)
+static void paint_arrow (GromitData *data,
+                         cairo_t *cr,
+                         GdkRGBA *color,
+                         gdouble x1, gdouble y1,
+                         gfloat width,
+                         gfloat direction,
+                         GdkRectangle *rect)
 {
-  GdkRectangle rect;
-  GdkPoint arrowhead [4];
-
-  /* get the data for this device */
-  GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
+  struct { gdouble x, y; } arrowhead [4];
 
   width = width / 2;
 
   /* I doubt that calculating the boundary box more exact is very useful */
-  rect.x = x1 - 4 * width - 1;
-  rect.y = y1 - 4 * width - 1;
-  rect.width = 8 * width + 2;
-  rect.height = 8 * width + 2;
+  rect->x = floor (x1 - 4 * width) - 1;
+  rect->y = floor (y1 - 4 * width) - 1;
+  rect->width = ceil (8 * width) + 3;
+  rect->height = ceil (8 * width) + 3;
 
   arrowhead [0].x = x1 + 4 * width * cos (direction);
   arrowhead [0].y = y1 + 4 * width * sin (direction);
@@ -74,74 +125,267 @@ void draw_arrow (GromitData *data,
   arrowhead [3].y = y1 + 3 * width * cos (direction)
                        - 3 * width * sin (direction);
 
-  if (devdata->cur_context->paint_ctx)
+  cairo_set_line_width(cr, 1);
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+
+  cairo_move_to(cr, arrowhead[0].x, arrowhead[0].y);
+  cairo_line_to(cr, arrowhead[1].x, arrowhead[1].y);
+  cairo_line_to(cr, arrowhead[2].x, arrowhead[2].y);
+  cairo_line_to(cr, arrowhead[3].x, arrowhead[3].y);
+  cairo_fill(cr);
+
+  gdk_cairo_set_source_rgba(cr, data->black);
+
+  cairo_move_to(cr, arrowhead[0].x, arrowhead[0].y);
+  cairo_line_to(cr, arrowhead[1].x, arrowhead[1].y);
+  cairo_line_to(cr, arrowhead[2].x, arrowhead[2].y);
+  cairo_line_to(cr, arrowhead[3].x, arrowhead[3].y);
+  cairo_line_to(cr, arrowhead[0].x, arrowhead[0].y);
+  cairo_stroke(cr);
+
+  gdk_cairo_set_source_rgba(cr, color);
+}
+
+
+/* the area the samples cover, with a pixel to spare for antialiasing */
+static void stroke_extents (GromitStrokeSample *s,
+                            guint n,
+                            GdkRectangle *rect)
+{
+  gdouble x1 = G_MAXDOUBLE, y1 = G_MAXDOUBLE;
+  gdouble x2 = -G_MAXDOUBLE, y2 = -G_MAXDOUBLE;
+  guint i;
+
+  for (i = 0; i < n; ++i)
     {
-      cairo_set_line_width(devdata->cur_context->paint_ctx, 1);
-      cairo_set_line_cap(devdata->cur_context->paint_ctx, CAIRO_LINE_CAP_ROUND);
-      cairo_set_line_join(devdata->cur_context->paint_ctx, CAIRO_LINE_JOIN_ROUND);
- 
-      cairo_move_to(devdata->cur_context->paint_ctx, arrowhead[0].x, arrowhead[0].y);
-      cairo_line_to(devdata->cur_context->paint_ctx, arrowhead[1].x, arrowhead[1].y);
-      cairo_line_to(devdata->cur_context->paint_ctx, arrowhead[2].x, arrowhead[2].y);
-      cairo_line_to(devdata->cur_context->paint_ctx, arrowhead[3].x, arrowhead[3].y);
-      cairo_fill(devdata->cur_context->paint_ctx);
+      gdouble r = MAX (s[i].width / 2.0, 0.5);
 
-      gdk_cairo_set_source_rgba(devdata->cur_context->paint_ctx, data->black);
+      x1 = MIN (x1, s[i].x - r);
+      y1 = MIN (y1, s[i].y - r);
+      x2 = MAX (x2, s[i].x + r);
+      y2 = MAX (y2, s[i].y + r);
+    }
 
-      cairo_move_to(devdata->cur_context->paint_ctx, arrowhead[0].x, arrowhead[0].y);
-      cairo_line_to(devdata->cur_context->paint_ctx, arrowhead[1].x, arrowhead[1].y);
-      cairo_line_to(devdata->cur_context->paint_ctx, arrowhead[2].x, arrowhead[2].y);
-      cairo_line_to(devdata->cur_context->paint_ctx, arrowhead[3].x, arrowhead[3].y);
-      cairo_line_to(devdata->cur_context->paint_ctx, arrowhead[0].x, arrowhead[0].y);
-      cairo_stroke(devdata->cur_context->paint_ctx);
+  rect->x = floor (x1) - 1;
+  rect->y = floor (y1) - 1;
+  rect->width = ceil (x2) - rect->x + 2;
+  rect->height = ceil (y2) - rect->y + 2;
+}
 
-      gdk_cairo_set_source_rgba(devdata->cur_context->paint_ctx, devdata->cur_context->paint_color);
-    
-      data->modified = 1;
 
-      gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0); 
+/*
+ * Builds the outline of a variable-width polyline as a set of subpaths:
+ * a disc around every sample plus, for every segment, the quad between
+ * the outer tangents of its two end discs. All subpaths run the same
+ * way round, so filling with the nonzero rule yields their union and no
+ * pixel is covered twice, which matters for translucent colours.
+ */
+static void paint_stroke (cairo_t *cr,
+                          GromitStrokeSample *s,
+                          guint n,
+                          GdkRectangle *rect)
+{
+  guint i;
+
+  cairo_new_path(cr);
+
+  for (i = 0; i < n; ++i)
+    {
+      gdouble r1 = MAX (s[i].width / 2.0, 0.5);
+
+      cairo_new_sub_path(cr);
+      cairo_arc(cr, s[i].x, s[i].y, r1, 0, 2 * M_PI);
+
+      if (i > 0)
+        {
+          gdouble r0 = MAX (s[i-1].width / 2.0, 0.5);
+          gdouble dx = s[i].x - s[i-1].x;
+          gdouble dy = s[i].y - s[i-1].y;
+          gdouble d = sqrt(dx * dx + dy * dy);
+
+          /* one disc contains the other, nothing to connect */
+          if (d <= fabs (r1 - r0))
+            continue;
+
+          gdouble ux = dx / d, uy = dy / d;
+          gdouble sn = (r0 - r1) / d;
+          gdouble cs = sqrt(1 - sn * sn);
+          /* tangent directions, seen from the disc centers */
+          gdouble ax = sn * ux - cs * uy, ay = sn * uy + cs * ux;
+          gdouble bx = sn * ux + cs * uy, by = sn * uy - cs * ux;
+
+          cairo_move_to(cr, s[i-1].x + r0 * ax, s[i-1].y + r0 * ay);
+          cairo_line_to(cr, s[i-1].x + r0 * bx, s[i-1].y + r0 * by);
+          cairo_line_to(cr, s[i].x + r1 * bx, s[i].y + r1 * by);
+          cairo_line_to(cr, s[i].x + r1 * ax, s[i].y + r1 * ay);
+          cairo_close_path(cr);
+        }
     }
 
-  data->painted = 1;
+  cairo_set_fill_rule(cr, CAIRO_FILL_RULE_WINDING);
+  cairo_fill(cr);
+
+  stroke_extents (s, n, rect);
 }
 
 
-void draw_circle (GromitData *data,
-                 GdkDevice *dev,
-                 gint x, gint y,
-                 gfloat radius)
+/*
+ * draws the given pressure samples as one filled outline
+ */
+void draw_stroke (GromitData *data,
+                  GdkDevice *dev,
+                  GromitStrokeSample *samples,
+                  guint n)
 {
   GdkRectangle rect;
   GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
+  guint i;
 
-  /* Invalidation rectangle */
-  rect.x = x - radius - data->maxwidth / 2;
-  rect.y = y - radius - data->maxwidth / 2;
-  rect.width = 2 * radius + data->maxwidth;
-  rect.height = 2 * radius + data->maxwidth;
+  if (n == 0)
+    return;
+
+  if(data->debug)
+    g_printerr("DEBUG: draw stroke of %u samples from %.1f %.1f\n", n, samples[0].x, samples[0].y);
 
-  if (devdata->cur_context->paint_ctx)
+  if (stroke_ctx (data, devdata))
     {
-      cairo_set_line_width(devdata->cur_context->paint_ctx, data->maxwidth);
-      cairo_set_line_cap(devdata->cur_context->paint_ctx, CAIRO_LINE_CAP_ROUND);
-      cairo_set_line_join(devdata->cur_context->paint_ctx, CAIRO_LINE_JOIN_ROUND);
+      /* brush dabs reach a few pixels further, see brush_stamp() */
+      stroke_extents (samples, n, &rect);
+      rect.x -= 4;
+      rect.y -= 4;
+      rect.width += 8;
+      rect.height += 8;
+      scratch_reserve (data, devdata, &rect);
 
-      if (devdata->cur_context->fill_color)
+      /* tablet pens deliver lots of samples, stamping is cheaper for them */
+      gboolean brush = (devdata->lastslave &&
+                        (gdk_device_get_source (devdata->lastslave) == GDK_SOURCE_PEN ||
+                         gdk_device_get_source (devdata->lastslave) == GDK_SOURCE_ERASER));
+
+      if (n >= GROMIT_TILE_MIN_SAMPLES)
         {
-          gdk_cairo_set_source_rgba(devdata->cur_context->paint_ctx, devdata->cur_context->fill_color);
+          /* e.g. a smoothed stroke on release, render it in parallel */
+          GromitOp *batch = undo_op_new (GROMIT_OP_STROKE, devdata->cur_context);
+          batch->color = *stroke_color (devdata);
+          batch->has_fill = FALSE;
+          batch->brush = brush;
+          /* scratch surfaces are drawn on opaquely, the blend comes later */
+          if (devdata->scratch_ctx)
+            batch->paint_type = GROMIT_PEN;
+          for (i = 1; i < n; ++i)
+            undo_op_add_line (batch, samples[i-1].x, samples[i-1].y,
+                              samples[i].x, samples[i].y, samples[i].width, NULL);
+
+          draw_ops_tiled (data, cairo_get_target (stroke_ctx (data, devdata)), &batch, 1, &rect);
+          undo_op_unref (batch);
+        }
+      else if (brush)
+        brush_stamp (data, stroke_ctx (data, devdata), samples, n, &rect);
+      else
+        paint_stroke (stroke_ctx (data, devdata), samples, n, &rect);
 
-          cairo_arc(devdata->cur_context->paint_ctx, x, y, radius, 0, 2 * M_PI);
-          cairo_fill(devdata->cur_context->paint_ctx);
+      stroke_damage (data, devdata, &rect);
 
-          gdk_cairo_set_source_rgba(devdata->cur_context->paint_ctx, devdata->cur_context->paint_color);
+      if (devdata->cur_op)
+        {
+          devdata->cur_op->brush |= brush;
+          if (n == 1)
+            undo_op_add_line (devdata->cur_op, samples[0].x, samples[0].y,
+                              samples[0].x, samples[0].y, samples[0].width, &rect);
+          for (i = 1; i < n; ++i)
+            undo_op_add_line (devdata->cur_op, samples[i-1].x, samples[i-1].y,
+                              samples[i].x, samples[i].y, samples[i].width, &rect);
         }
+    }
 
-      cairo_arc(devdata->cur_context->paint_ctx, x, y, radius, 0, 2 * M_PI);
-      cairo_stroke(devdata->cur_context->paint_ctx);
+  data->painted = 1;
+}
 
-      data->modified = 1;
 
-      gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+void draw_arrow (GromitData *data, 
+		 GdkDevice *dev,
+		 gdouble x1, gdouble y1,
+		 gfloat width,
+		 gfloat direction)
+{
+  GdkRectangle rect;
+
+  /* get the data for this device */
+  GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
+
+  if (stroke_ctx (data, devdata))
+    {
+      /* as paint_arrow() reckons it */
+      rect.x = floor (x1 - 2 * width) - 1;
+      rect.y = floor (y1 - 2 * width) - 1;
+      rect.width = rect.height = ceil (4 * width) + 3;
+      scratch_reserve (data, devdata, &rect);
+
+      paint_arrow (data, stroke_ctx (data, devdata), stroke_color (devdata),
+                   x1, y1, width, direction, &rect);
+    
+      stroke_damage (data, devdata, &rect);
+
+      if (devdata->cur_op)
+        undo_op_add_prim (devdata->cur_op, GROMIT_PRIM_ARROW, x1, y1, width, direction, &rect);
+    }
+
+  data->painted = 1;
+}
+
+
+static void paint_circle (cairo_t *cr,
+                          GdkRGBA *color,
+                          GdkRGBA *fill_color,
+                          gdouble x, gdouble y,
+                          gfloat radius,
+                          gdouble width)
+{
+  cairo_set_line_width(cr, width);
+  cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+  cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+
+  if (fill_color)
+    {
+      gdk_cairo_set_source_rgba(cr, fill_color);
+
+      cairo_arc(cr, x, y, radius, 0, 2 * M_PI);
+      cairo_fill(cr);
+
+      gdk_cairo_set_source_rgba(cr, color);
+    }
+
+  cairo_arc(cr, x, y, radius, 0, 2 * M_PI);
+  cairo_stroke(cr);
+}
+
+
+void draw_circle (GromitData *data,
+                 GdkDevice *dev,
+                 gdouble x, gdouble y,
+                 gfloat radius)
+{
+  GdkRectangle rect;
+  GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
+
+  /* Invalidation rectangle */
+  rect.x = floor (x - radius - data->maxwidth / 2.0) - 1;
+  rect.y = floor (y - radius - data->maxwidth / 2.0) - 1;
+  rect.width = ceil (2 * radius + data->maxwidth) + 3;
+  rect.height = ceil (2 * radius + data->maxwidth) + 3;
+
+  if (stroke_ctx (data, devdata))
+    {
+      scratch_reserve (data, devdata, &rect);
+      paint_circle (stroke_ctx (data, devdata),
+                    stroke_color (devdata), devdata->cur_context->fill_color,
+                    x, y, radius, data->maxwidth);
+
+      stroke_damage (data, devdata, &rect);
+
+      if (devdata->cur_op)
+        undo_op_add_prim (devdata->cur_op, GROMIT_PRIM_CIRCLE, x, y, data->maxwidth, radius, &rect);
     }
 
   data->painted = 1;
@@ -149,8 +393,8 @@ void draw_circle (GromitData *data,
 
 void draw_length_label (GromitData *data,
                         GdkDevice *dev,
-                        gint x1, gint y1,
-                        gint x2, gint y2)
+                        gdouble x1, gdouble y1,
+                        gdouble x2, gdouble y2)
 {
   gdouble dx = x2 - x1;
   gdouble dy = y2 - y1;
@@ -167,46 +411,1788 @@ void draw_length_label (GromitData *data,
   draw_string_label(data, dev, mx, my, label);
 }
 
-void draw_string_label (GromitData *data, GdkDevice *dev, gint x, gint y, char *label)
+/* a glyph rasterised once into an A8 mask */
+typedef struct
 {
-  GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
-  cairo_t *cr = devdata->cur_context->paint_ctx;
+  cairo_surface_t *mask;    /* NULL for glyphs without ink, like space */
+  gint     x, y;            /* mask origin relative to the pen position */
+  gdouble  advance;
+  gdouble  ink_x1, ink_y1, ink_x2, ink_y2;
+} GromitGlyph;
 
-  cairo_save(cr);
+/* the label font at one text size */
+typedef struct
+{
+  cairo_scaled_font_t *font;
+  guint       scale;        /* of the glyph masks */
+  gdouble     ascent;
+  gdouble     line_height;
+  GHashTable *glyphs;       /* by unicode character */
+} GromitLabelFont;
+
+
+static void label_glyph_free (gpointer ptr)
+{
+  GromitGlyph *glyph = ptr;
+  if (glyph->mask)
+    cairo_surface_destroy (glyph->mask);
+  g_free (glyph);
+}
 
-  cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-  cairo_set_font_size(cr, devdata->cur_context->textsize);
+
+static GromitGlyph *label_glyph_get (GromitLabelFont *lf, gunichar c)
+{
+  guint scale = lf->scale;
+  GromitGlyph *glyph = g_hash_table_lookup (lf->glyphs, GUINT_TO_POINTER (c));
+  cairo_glyph_t *glyphs = NULL;
   cairo_text_extents_t extents;
-  cairo_text_extents(cr, label, &extents);
+  gchar utf8[8];
+  gint n = 0;
+
+  if (glyph)
+    return glyph;
+
+  glyph = g_new0 (GromitGlyph, 1);
+  utf8[g_unichar_to_utf8 (c, utf8)] = 0;
+
+  if (cairo_scaled_font_text_to_glyphs (lf->font, 0, 0, utf8, -1,
+                                        &glyphs, &n, NULL, NULL, NULL) == CAIRO_STATUS_SUCCESS
+      && n > 0)
+    {
+      cairo_scaled_font_glyph_extents (lf->font, glyphs, n, &extents);
+      glyph->advance = extents.x_advance;
 
-  gdouble padding = 4.0;
-  gdouble tx = x - extents.width / 2.0;
-  gdouble ty = y - extents.height / 2.0;
+      if (extents.width > 0 && extents.height > 0)
+        {
+          glyph->ink_x1 = extents.x_bearing;
+          glyph->ink_y1 = extents.y_bearing;
+          glyph->ink_x2 = extents.x_bearing + extents.width;
+          glyph->ink_y2 = extents.y_bearing + extents.height;
+
+          /* one pixel of room for antialiasing on every side */
+          glyph->x = floor (glyph->ink_x1) - 1;
+          glyph->y = floor (glyph->ink_y1) - 1;
+          glyph->mask = cairo_image_surface_create (CAIRO_FORMAT_A8,
+                                                    (ceil (glyph->ink_x2) - glyph->x + 1) * scale,
+                                                    (ceil (glyph->ink_y2) - glyph->y + 1) * scale);
+          cairo_surface_set_device_scale (glyph->mask, scale, scale);
+          cairo_t *cr = cairo_create (glyph->mask);
+          cairo_set_scaled_font (cr, lf->font);
+          cairo_translate (cr, -glyph->x, -glyph->y);
+          cairo_show_glyphs (cr, glyphs, n);
+          cairo_destroy (cr);
+        }
+    }
+  cairo_glyph_free (glyphs);
+
+  g_hash_table_insert (lf->glyphs, GUINT_TO_POINTER (c), glyph);
+  return glyph;
+}
+
+
+/*
+ * the cached label font for the given size, created on first use
+ */
+static GromitLabelFont *label_font_get (GromitData *data, gfloat textsize, gboolean antialias)
+{
+  /* 1/16 pt is finer than anyone configures */
+  guint key = (((guint) (textsize * 16 + 0.5)) * 2 + antialias) * (GROMIT_MAX_SCALE + 1) + data->scale;
+  GromitLabelFont *lf;
+
+  if (!data->label_fonts)
+    data->label_fonts = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  lf = g_hash_table_lookup (data->label_fonts, GUINT_TO_POINTER (key));
+  if (lf)
+    return lf;
+
+  cairo_font_face_t *face = cairo_toy_font_face_create ("Sans", CAIRO_FONT_SLANT_NORMAL,
+                                                        CAIRO_FONT_WEIGHT_BOLD);
+  cairo_font_options_t *options = cairo_font_options_create ();
+  cairo_matrix_t size, ctm;
+
+  cairo_font_options_set_antialias (options, antialias ? CAIRO_ANTIALIAS_GRAY
+                                                       : CAIRO_ANTIALIAS_NONE);
+  cairo_matrix_init_scale (&size, textsize, textsize);
+  cairo_matrix_init_identity (&ctm);
+
+  lf = g_new0 (GromitLabelFont, 1);
+  lf->font = cairo_scaled_font_create (face, &size, &ctm, options);
+  lf->scale = data->scale;
+  lf->glyphs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, label_glyph_free);
+
+  cairo_font_extents_t extents;
+  cairo_scaled_font_extents (lf->font, &extents);
+  lf->ascent = ceil (extents.ascent);
+  lf->line_height = ceil (extents.height);
+
+  cairo_font_options_destroy (options);
+  cairo_font_face_destroy (face);
+
+  /* what length labels are made of */
+  for (const gchar *p = "0123456789 px"; *p; ++p)
+    label_glyph_get (lf, *p);
+
+  g_hash_table_insert (data->label_fonts, GUINT_TO_POINTER (key), lf);
+
+  if(data->debug)
+    g_printerr("DEBUG: Created label font of size %.1f.\n", textsize);
+
+  return lf;
+}
+
+
+#define LABEL_PADDING 4.0
+
+/*
+ * Lays out the label centered at (x,y): the ink extents of its glyphs
+ * relative to the pen, where the pen starts and the area it covers with
+ * its box. Call with the label lock held.
+ */
+static void label_layout (GromitLabelFont *lf,
+                          gint x, gint y,
+                          const char *label,
+                          gdouble ink[4],
+                          gdouble *tx, gdouble *ty,
+                          GdkRectangle *rect)
+{
+  gdouble ink_x1 = G_MAXDOUBLE, ink_y1 = G_MAXDOUBLE;
+  gdouble ink_x2 = -G_MAXDOUBLE, ink_y2 = -G_MAXDOUBLE;
+  gdouble pen = 0;
+  const gchar *p;
+
+  for (p = label; *p; p = g_utf8_next_char (p))
+    {
+      GromitGlyph *glyph = label_glyph_get (lf, g_utf8_get_char (p));
+      if (glyph->mask)
+        {
+          ink_x1 = MIN (ink_x1, pen + glyph->ink_x1);
+          ink_y1 = MIN (ink_y1, glyph->ink_y1);
+          ink_x2 = MAX (ink_x2, pen + glyph->ink_x2);
+          ink_y2 = MAX (ink_y2, glyph->ink_y2);
+        }
+      pen += glyph->advance;
+    }
+
+  if (ink_x1 > ink_x2)
+    ink_x1 = ink_y1 = ink_x2 = ink_y2 = 0;
+
+  ink[0] = ink_x1;
+  ink[1] = ink_y1;
+  ink[2] = ink_x2;
+  ink[3] = ink_y2;
+  *tx = x - (ink_x2 - ink_x1) / 2.0;
+  *ty = y - (ink_y2 - ink_y1) / 2.0;
+
+  rect->x = (int)(*tx + ink_x1 - LABEL_PADDING - 1);
+  rect->y = (int)(*ty + ink_y1 - LABEL_PADDING - 1);
+  rect->width = (int)(ink_x2 - ink_x1 + 2 * LABEL_PADDING + 3);
+  rect->height = (int)(ink_y2 - ink_y1 + 2 * LABEL_PADDING + 3);
+}
+
+
+/*
+ * the area paint_string_label() would cover
+ */
+static void string_label_extents (GromitData *data,
+                                  gint x, gint y,
+                                  const char *label,
+                                  gfloat textsize,
+                                  gboolean antialias,
+                                  GdkRectangle *rect)
+{
+  gdouble ink[4], tx, ty;
+
+  g_mutex_lock (&data->label_lock);
+  label_layout (label_font_get (data, textsize, antialias), x, y, label, ink, &tx, &ty, rect);
+  g_mutex_unlock (&data->label_lock);
+}
+
+
+/*
+ * Draws the label centered at (x,y) on a translucent box. Glyphs come
+ * from a per-size cache, so this is a rectangle fill plus one mask blit
+ * per character.
+ */
+static void paint_string_label (GromitData *data,
+                                cairo_t *cr,
+                                gint x, gint y,
+                                const char *label,
+                                gfloat textsize,
+                                GdkRectangle *rect)
+{
+  gdouble ink[4], tx, ty;
+  gdouble pen = 0;
+  const gchar *p;
+
+  /* tile workers may render labels concurrently */
+  g_mutex_lock (&data->label_lock);
+
+  GromitLabelFont *lf = label_font_get (data, textsize,
+                                        cairo_get_antialias (cr) != CAIRO_ANTIALIAS_NONE);
+  label_layout (lf, x, y, label, ink, &tx, &ty, rect);
+
+  cairo_save(cr);
 
   cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
   cairo_set_source_rgba(cr, 0, 0, 0, 0.5);
   cairo_rectangle(cr,
-                  tx + extents.x_bearing - padding,
-                  ty + extents.y_bearing - padding,
-                  extents.width + 2 * padding,
-                  extents.height + 2 * padding);
+                  tx + ink[0] - LABEL_PADDING,
+                  ty + ink[1] - LABEL_PADDING,
+                  ink[2] - ink[0] + 2 * LABEL_PADDING,
+                  ink[3] - ink[1] + 2 * LABEL_PADDING);
   cairo_fill(cr);
 
   cairo_set_source_rgba(cr, 1, 1, 1, 1.0);
-  cairo_move_to(cr, tx, ty);
-  cairo_show_text(cr, label);
+  for (p = label; *p; p = g_utf8_next_char (p))
+    {
+      GromitGlyph *glyph = label_glyph_get (lf, g_utf8_get_char (p));
+      if (glyph->mask)
+        cairo_mask_surface(cr, glyph->mask,
+                           floor (tx + pen + 0.5) + glyph->x,
+                           floor (ty + 0.5) + glyph->y);
+      pen += glyph->advance;
+    }
 
   cairo_restore(cr);
-  gdk_cairo_set_source_rgba(cr, devdata->cur_context->paint_color);
 
-  /* Invalidation rectangle */
+  g_mutex_unlock (&data->label_lock);
+}
+
+
+void draw_string_label (GromitData *data, GdkDevice *dev, gint x, gint y, char *label)
+{
+  GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
   GdkRectangle rect;
-  rect.x = (int)(tx + extents.x_bearing - padding - 1);
-  rect.y = (int)(ty + extents.y_bearing - padding - 1);
-  rect.width = (int)(extents.width + 2 * padding + 3);
-  rect.height = (int)(extents.height + 2 * padding + 3);
 
+  if (devdata->scratch_ctx)
+    {
+      string_label_extents (data, x, y, label, devdata->cur_context->textsize,
+                            cairo_get_antialias (devdata->scratch_ctx) != CAIRO_ANTIALIAS_NONE,
+                            &rect);
+      scratch_reserve (data, devdata, &rect);
+    }
+
+  cairo_t *cr = stroke_ctx (data, devdata);
+  paint_string_label(data, cr, x, y, label, devdata->cur_context->textsize, &rect);
+  gdk_cairo_set_source_rgba(cr, stroke_color (devdata));
+
+  stroke_damage (data, devdata, &rect);
+
+  if (devdata->cur_op)
+    {
+      undo_op_set_label (devdata->cur_op, label);
+      undo_op_add_prim (devdata->cur_op, GROMIT_PRIM_LABEL, x, y,
+                        devdata->cur_context->textsize, 0, &rect);
+    }
+}
+
+
+/* a typed character and what its glyph covered before */
+typedef struct
+{
+  gsize            offset;  /* into the string */
+  gdouble          pen;
+  guint            line;
+  GdkRectangle     rect;
+  cairo_surface_t *under;   /* NULL for glyphs without ink and line breaks */
+} GromitTextChar;
+
+struct _GromitText
+{
+  GdkDevice    *keyboard;
+  GromitOp     *op;
+  gint          x, y;       /* top left of the first line */
+  gfloat        textsize;
+  gboolean      antialias;
+  gdouble       ascent;
+  gdouble       line_height;
+  GString      *string;
+  GArray       *chars;      /* of GromitTextChar */
+  gdouble       pen;        /* where the next glyph goes */
+  guint         line;
+  GdkRectangle  rect;       /* covered by all glyphs so far */
+  GdkRectangle  caret;
+};
+
+
+/* the pixel the glyph origin of a character at pen position 'pen' snaps to */
+static void text_origin (GromitLabelFont *lf, gint x, gint y,
+                         gdouble pen, guint line, gint *gx, gint *gy)
+{
+  *gx = floor (x + pen + 0.5);
+  *gy = y + lf->ascent + line * lf->line_height;
+}
+
+
+/*
+ * Draws typed text with its top left at (x,y), the same way text_key()
+ * put it down glyph by glyph.
+ */
+static void paint_text (GromitData *data,
+                        cairo_t *cr,
+                        gint x, gint y,
+                        const char *text,
+                        gfloat textsize)
+{
+  const gchar *p;
+  gdouble pen = 0;
+  guint line = 0;
+  gint gx, gy;
+
+  g_mutex_lock (&data->label_lock);
+
+  GromitLabelFont *lf = label_font_get (data, textsize,
+                                        cairo_get_antialias (cr) != CAIRO_ANTIALIAS_NONE);
+
+  for (p = text; *p; p = g_utf8_next_char (p))
+    {
+      gunichar c = g_utf8_get_char (p);
+      if (c == '\n')
+        {
+          pen = 0;
+          line++;
+          continue;
+        }
+
+      GromitGlyph *glyph = label_glyph_get (lf, c);
+      text_origin (lf, x, y, pen, line, &gx, &gy);
+      if (glyph->mask)
+        cairo_mask_surface (cr, glyph->mask, gx + glyph->x, gy + glyph->y);
+      pen += glyph->advance;
+    }
+
+  g_mutex_unlock (&data->label_lock);
+}
+
+
+static void text_caret_move (GromitData *data, GromitText *text)
+{
+  GdkWindow *window = gtk_widget_get_window (data->win);
+
+  gdk_window_invalidate_rect (window, &text->caret, 0);
+  text->caret.x = floor (text->x + text->pen + 0.5);
+  text->caret.y = text->y + text->line * text->line_height;
+  text->caret.width = 2;
+  text->caret.height = text->line_height;
+  gdk_window_invalidate_rect (window, &text->caret, 0);
+  /* without compositing, the window shape has to follow */
   data->modified = 1;
+}
 
-  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
-}
\ No newline at end of file
+
+/*
+ * Starts typing text with its top left at (x,y) in the tool's colour and
+ * text size, grabbing the keyboard that belongs to the device.
+ */
+void text_begin (GromitData *data, GromitDeviceData *devdata, gint x, gint y)
+{
+  GromitText *text;
+
+  text_end (data, devdata);
+
+  text = devdata->text = g_new0 (GromitText, 1);
+  text->op = undo_op_new (GROMIT_OP_STROKE, devdata->cur_context);
+  text->op->device = devdata->device;
+  text->x = x;
+  text->y = y;
+  text->textsize = devdata->cur_context->textsize;
+  text->antialias = data->composited;
+  text->string = g_string_new (NULL);
+  text->chars = g_array_new (FALSE, FALSE, sizeof (GromitTextChar));
+
+  g_mutex_lock (&data->label_lock);
+  GromitLabelFont *lf = label_font_get (data, text->textsize, text->antialias);
+  text->ascent = lf->ascent;
+  text->line_height = lf->line_height;
+  g_mutex_unlock (&data->label_lock);
+
+  text->keyboard = gdk_device_get_associated_device (devdata->device);
+  if (text->keyboard &&
+      gdk_device_grab (text->keyboard, gtk_widget_get_window (data->win),
+                       GDK_OWNERSHIP_NONE, FALSE, GDK_KEY_PRESS_MASK,
+                       NULL, GDK_CURRENT_TIME) != GDK_GRAB_SUCCESS)
+    {
+      g_printerr ("WARNING: Grabbing keyboard '%s' for typing failed.\n",
+                  gdk_device_get_name (text->keyboard));
+      text->keyboard = NULL;
+    }
+
+  text_caret_move (data, text);
+}
+
+
+/*
+ * puts down one character at the pen, saving what its glyph covers
+ */
+static void text_put (GromitData *data, GromitText *text, gunichar c)
+{
+  GromitTextChar tc = { text->string->len, text->pen, text->line, { 0, 0, 0, 0 }, NULL };
+  gint gx, gy;
+
+  g_string_append_unichar (text->string, c);
+
+  if (c == '\n')
+    {
+      text->pen = 0;
+      text->line++;
+      g_array_append_val (text->chars, tc);
+      return;
+    }
+
+  g_mutex_lock (&data->label_lock);
+
+  GromitLabelFont *lf = label_font_get (data, text->textsize, text->antialias);
+  GromitGlyph *glyph = label_glyph_get (lf, c);
+  text_origin (lf, text->x, text->y, text->pen, text->line, &gx, &gy);
+  text->pen += glyph->advance;
+
+  if (glyph->mask)
+    {
+      tc.rect.x = gx + glyph->x;
+      tc.rect.y = gy + glyph->y;
+      tc.rect.width = cairo_image_surface_get_width (glyph->mask) / lf->scale;
+      tc.rect.height = cairo_image_surface_get_height (glyph->mask) / lf->scale;
+
+      tc.under = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                             tc.rect.width * data->scale,
+                                             tc.rect.height * data->scale);
+      cairo_surface_set_device_scale (tc.under, data->scale, data->scale);
+      cairo_t *cr = cairo_create (tc.under);
+      cairo_set_source_surface (cr, data->backbuffer, -tc.rect.x, -tc.rect.y);
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+      cairo_paint (cr);
+      cairo_destroy (cr);
+
+      cr = cairo_create (data->backbuffer);
+      gdk_cairo_set_source_rgba (cr, &text->op->color);
+      cairo_mask_surface (cr, glyph->mask, tc.rect.x, tc.rect.y);
+      cairo_destroy (cr);
+    }
+
+  g_mutex_unlock (&data->label_lock);
+
+  g_array_append_val (text->chars, tc);
+
+  if (tc.under)
+    {
+      if (text->rect.width > 0)
+        gdk_rectangle_union (&text->rect, &tc.rect, &text->rect);
+      else
+        text->rect = tc.rect;
+      gdk_window_invalidate_rect (gtk_widget_get_window (data->win), &tc.rect, 0);
+      data->modified = 1;
+      data->painted = 1;
+    }
+}
+
+
+/*
+ * takes back the last character, putting back what its glyph covered
+ */
+static void text_erase (GromitData *data, GromitText *text)
+{
+  GromitTextChar *tc;
+
+  if (text->chars->len == 0)
+    return;
+
+  tc = &g_array_index (text->chars, GromitTextChar, text->chars->len - 1);
+  if (tc->under)
+    {
+      cairo_t *cr = cairo_create (data->backbuffer);
+      cairo_set_source_surface (cr, tc->under, tc->rect.x, tc->rect.y);
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+      gdk_cairo_rectangle (cr, &tc->rect);
+      cairo_fill (cr);
+      cairo_destroy (cr);
+      cairo_surface_destroy (tc->under);
+
+      gdk_window_invalidate_rect (gtk_widget_get_window (data->win), &tc->rect, 0);
+      data->modified = 1;
+    }
+
+  text->pen = tc->pen;
+  text->line = tc->line;
+  g_string_truncate (text->string, tc->offset);
+  g_array_set_size (text->chars, text->chars->len - 1);
+}
+
+
+/*
+ * Handles a key typed on the device's keyboard. Only the glyph of the
+ * new character is drawn and redrawn, taken from the label glyph cache.
+ */
+gboolean text_key (GromitData *data, GromitDeviceData *devdata, guint keyval)
+{
+  GromitText *text = devdata->text;
+  gunichar c;
+
+  if (!text)
+    return FALSE;
+
+  switch (keyval)
+    {
+    case GDK_KEY_Escape:
+      text_end (data, devdata);
+      return TRUE;
+    case GDK_KEY_Return:
+    case GDK_KEY_KP_Enter:
+      text_put (data, text, '\n');
+      break;
+    case GDK_KEY_BackSpace:
+      text_erase (data, text);
+      break;
+    default:
+      c = gdk_keyval_to_unicode (keyval);
+      if (!c || !g_unichar_isprint (c))
+        return FALSE;
+      text_put (data, text, c);
+    }
+
+  text_caret_move (data, text);
+  return TRUE;
+}
+
+
+/*
+ * finishes the device's text, which becomes one undoable op
+ */
+void text_end (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitText *text = devdata->text;
+  guint i;
+
+  if (!text)
+    return;
+
+  devdata->text = NULL;
+
+  if (text->keyboard)
+    gdk_device_ungrab (text->keyboard, GDK_CURRENT_TIME);
+
+  gdk_window_invalidate_rect (gtk_widget_get_window (data->win), &text->caret, 0);
+  data->modified = 1;
+
+  for (i = 0; i < text->chars->len; ++i)
+    {
+      GromitTextChar *tc = &g_array_index (text->chars, GromitTextChar, i);
+      if (tc->under)
+        cairo_surface_destroy (tc->under);
+    }
+  g_array_free (text->chars, TRUE);
+
+  if (text->rect.width > 0)
+    {
+      undo_op_set_label (text->op, text->string->str);
+      undo_op_add_prim (text->op, GROMIT_PRIM_TEXT, text->x, text->y,
+                        text->textsize, 0, &text->rect);
+      undo_commit (data, text->op);
+    }
+  else
+    undo_op_unref (text->op);
+
+  if(data->debug)
+    g_printerr("DEBUG: Typed \"%s\".\n", text->string->str);
+
+  g_string_free (text->string, TRUE);
+  g_free (text);
+}
+
+
+/*
+ * commits the texts of all devices, before something else changes the history
+ */
+void text_end_all (GromitData *data)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  if (!data->devdatatable)
+    return;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    text_end (data, value);
+}
+
+
+/*
+ * adds the carets of all texts being typed to the window shape used
+ * without compositing, their glyphs are in the backbuffer already
+ */
+void text_shape (GromitData *data, cairo_region_t *region)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitText *text = ((GromitDeviceData *) value)->text;
+      if (!text)
+        continue;
+      /* only the caret's first column is drawn, see text_expose() */
+      GdkRectangle caret = { text->caret.x, text->caret.y, 1, text->caret.height };
+      cairo_region_union_rectangle (region, &caret);
+    }
+}
+
+
+/*
+ * draws the carets of all texts being typed
+ */
+void text_expose (GromitData *data, cairo_t *cr)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitText *text = ((GromitDeviceData *) value)->text;
+      if (!text)
+        continue;
+
+      cairo_save (cr);
+      gdk_cairo_set_source_rgba (cr, &text->op->color);
+      cairo_rectangle (cr, text->caret.x, text->caret.y, 1, text->caret.height);
+      cairo_fill (cr);
+      cairo_restore (cr);
+    }
+}
+
+
+/*
+  Scanline flood fill on the backbuffer pixels. Every span of matching
+  pixels is found in one left/right scan and marked in a bitmap, seeds
+  for the rows above and below go on an explicit stack. The result is an
+  A1 mask of the filled area and one of the pixels bordering it, the
+  antialiased rim of the outline, which are painted and kept for undo,
+  so replaying a fill does not depend on what is below it.
+*/
+
+typedef struct
+{
+  gint x, y;
+} GromitFillSeed;
+
+typedef struct
+{
+  gint y, x1, x2;
+} GromitFillSpan;
+
+
+static inline gboolean fill_match (guint32 pixel, guint32 seed)
+{
+  guint i;
+
+  /* the common case, e.g. filling empty screen */
+  if (pixel == seed)
+    return TRUE;
+
+  for (i = 0; i < 32; i += 8)
+    if (ABS ((gint) ((pixel >> i) & 0xff) - (gint) ((seed >> i) & 0xff)) > GROMIT_FILL_TOLERANCE)
+      return FALSE;
+  return TRUE;
+}
+
+
+/*
+ * sets pixels x1 to x2 of row y of an A1 mask
+ */
+static void fill_mask_span (guchar *bits, gint stride, gint y, gint x1, gint x2)
+{
+  guint32 *row = (guint32 *) (bits + (gsize) y * stride);
+  gint x;
+
+  for (x = x1; x <= x2; ++x)
+    row[x >> 5] |= 1u << (G_BYTE_ORDER == G_LITTLE_ENDIAN ? (x & 31) : 31 - (x & 31));
+}
+
+#define FILL_VISITED(x,y) (visited[(gsize) (y) * width + (x)])
+
+
+/*
+ * Finds the area around (x,y), in pixels, and returns its mask or NULL,
+ * and in 'rim' the mask of the pixels around it. Both cover 'box'.
+ */
+static cairo_surface_t *fill_mask (GromitData *data, gint px, gint py, GdkRectangle *box,
+                                   cairo_surface_t **rim)
+{
+  cairo_surface_t *surface = data->backbuffer;
+  gint width = cairo_image_surface_get_width (surface);
+  gint height = cairo_image_surface_get_height (surface);
+  gint stride = cairo_image_surface_get_stride (surface);
+  guchar *pixels;
+  guint8 *visited;
+  GArray *stack, *spans;
+  gint x, y, x1, x2, dy;
+  gboolean capped = FALSE;
+  guint i;
+
+  if (px < 0 || py < 0 || px >= width || py >= height)
+    return NULL;
+
+  cairo_surface_flush (surface);
+  pixels = cairo_image_surface_get_data (surface);
+#define FILL_PIXEL(x,y) (((guint32 *) (pixels + (gsize) (y) * stride))[x])
+
+  /* kept between fills, only the spans found are cleared afterwards */
+  if (data->fill_visited_size != (gsize) width * height)
+    {
+      g_free (data->fill_visited);
+      data->fill_visited_size = (gsize) width * height;
+      data->fill_visited = g_malloc0 (data->fill_visited_size);
+    }
+  visited = data->fill_visited;
+
+  guint32 seed = FILL_PIXEL (px, py);
+  stack = g_array_new (FALSE, FALSE, sizeof (GromitFillSeed));
+  spans = g_array_new (FALSE, FALSE, sizeof (GromitFillSpan));
+
+  GromitFillSeed start = { px, py };
+  g_array_append_val (stack, start);
+  gint minx = px, maxx = px, miny = py, maxy = py;
+
+  while (stack->len > 0)
+    {
+      GromitFillSeed s = g_array_index (stack, GromitFillSeed, stack->len - 1);
+      g_array_set_size (stack, stack->len - 1);
+
+      if (FILL_VISITED (s.x, s.y))
+        continue;
+
+      x1 = x2 = s.x;
+      while (x1 > 0 && !FILL_VISITED (x1 - 1, s.y) && fill_match (FILL_PIXEL (x1 - 1, s.y), seed))
+        x1--;
+      while (x2 < width - 1 && !FILL_VISITED (x2 + 1, s.y) && fill_match (FILL_PIXEL (x2 + 1, s.y), seed))
+        x2++;
+
+      memset (&FILL_VISITED (x1, s.y), 1, x2 - x1 + 1);
+      GromitFillSpan span = { s.y, x1, x2 };
+      g_array_append_val (spans, span);
+      minx = MIN (minx, x1);
+      maxx = MAX (maxx, x2);
+      miny = MIN (miny, s.y);
+      maxy = MAX (maxy, s.y);
+
+      /* at the bound spans are still filled, but seed no new ones */
+      if (stack->len >= GROMIT_FILL_MAX_SEEDS)
+        {
+          if (!capped && data->debug)
+            g_printerr ("DEBUG: Fill reached %u seeds, parts of it may stay empty.\n", stack->len);
+          capped = TRUE;
+          continue;
+        }
+
+      /* one seed per run of matching pixels next to the span */
+      for (dy = -1; dy <= 1; dy += 2)
+        {
+          y = s.y + dy;
+          if (y < 0 || y >= height)
+            continue;
+          for (x = x1; x <= x2; ++x)
+            {
+              if (FILL_VISITED (x, y) || !fill_match (FILL_PIXEL (x, y), seed))
+                continue;
+              GromitFillSeed next = { x, y };
+              g_array_append_val (stack, next);
+              while (x < x2 && !FILL_VISITED (x + 1, y) && fill_match (FILL_PIXEL (x + 1, y), seed))
+                x++;
+            }
+        }
+    }
+#undef FILL_PIXEL
+
+  g_array_free (stack, TRUE);
+
+  /* the rim reaches one pixel beyond the area */
+  box->x = MAX (minx - 1, 0);
+  box->y = MAX (miny - 1, 0);
+  box->width = MIN (maxx + 1, width - 1) - box->x + 1;
+  box->height = MIN (maxy + 1, height - 1) - box->y + 1;
+
+  cairo_surface_t *mask = cairo_image_surface_create (CAIRO_FORMAT_A1, box->width, box->height);
+  guchar *bits = cairo_image_surface_get_data (mask);
+  *rim = cairo_image_surface_create (CAIRO_FORMAT_A1, box->width, box->height);
+  guchar *rim_bits = cairo_image_surface_get_data (*rim);
+  gint mask_stride = cairo_image_surface_get_stride (mask);
+
+  for (i = 0; i < spans->len; ++i)
+    {
+      GromitFillSpan *span = &g_array_index (spans, GromitFillSpan, i);
+      fill_mask_span (bits, mask_stride, span->y - box->y, span->x1 - box->x, span->x2 - box->x);
+      /* grown to the four neighbours, so it cannot leak across thin diagonals */
+      fill_mask_span (rim_bits, mask_stride, span->y - box->y,
+                      MAX (span->x1 - 1, 0) - box->x, MIN (span->x2 + 1, width - 1) - box->x);
+      for (dy = -1; dy <= 1; dy += 2)
+        if (span->y + dy >= 0 && span->y + dy < height)
+          fill_mask_span (rim_bits, mask_stride, span->y + dy - box->y,
+                          span->x1 - box->x, span->x2 - box->x);
+      memset (&FILL_VISITED (span->x1, span->y), 0, span->x2 - span->x1 + 1);
+    }
+
+  /* the rim is the grown area without the area itself */
+  for (i = 0; i < (guint) (box->height * mask_stride / 4); ++i)
+    ((guint32 *) rim_bits)[i] &= ~((guint32 *) bits)[i];
+
+  cairo_surface_mark_dirty (mask);
+  cairo_surface_mark_dirty (*rim);
+
+  g_array_free (spans, TRUE);
+  return mask;
+}
+#undef FILL_VISITED
+
+
+/*
+ * fills the area of similar colour around (x,y) with the tool's colour
+ */
+void draw_fill (GromitData *data, GdkDevice *dev, gint x, gint y)
+{
+  GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
+  GdkRectangle box, rect;
+  gint64 start = g_get_monotonic_time ();
+
+  cairo_surface_t *rim;
+  cairo_surface_t *mask = fill_mask (data, x * data->scale, y * data->scale, &box, &rim);
+  if (!mask)
+    return;
+  cairo_surface_set_device_scale (mask, data->scale, data->scale);
+  cairo_surface_set_device_scale (rim, data->scale, data->scale);
+
+  rect.x = box.x / data->scale;
+  rect.y = box.y / data->scale;
+  rect.width = (box.x + box.width + data->scale - 1) / data->scale - rect.x;
+  rect.height = (box.y + box.height + data->scale - 1) / data->scale - rect.y;
+
+  GromitOp *op = undo_op_new (GROMIT_OP_STROKE, devdata->cur_context);
+  op->device = devdata->device;
+  op->has_fill = FALSE;
+  op->mask = mask;
+  op->rim = rim;
+  undo_op_add_prim (op, GROMIT_PRIM_MASK, (gdouble) box.x / data->scale,
+                    (gdouble) box.y / data->scale, 0, 0, &rect);
+  undo_op_add_prim (op, GROMIT_PRIM_RIM, (gdouble) box.x / data->scale,
+                    (gdouble) box.y / data->scale, 0, 0, &rect);
+
+  cairo_t *cr = cairo_create (data->backbuffer);
+  draw_op (data, cr, op);
+  cairo_destroy (cr);
+
+  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+  data->modified = 1;
+  data->painted = 1;
+
+  undo_commit (data, op);
+
+  if(data->debug)
+    g_printerr("DEBUG: Filled %dx%d+%d+%d in %.2f ms.\n", rect.width, rect.height, rect.x, rect.y,
+               (g_get_monotonic_time () - start) / 1000.0);
+}
+
+
+static void paint_polyline (GromitData *data, cairo_t *cr, GromitOp *op, GArray *stroke)
+{
+  GdkRectangle rect;
+
+  if (stroke->len == 0)
+    return;
+
+  if (op->brush)
+    brush_stamp (data, cr, (GromitStrokeSample *) stroke->data, stroke->len, &rect);
+  else
+    paint_stroke (cr, (GromitStrokeSample *) stroke->data, stroke->len, &rect);
+
+  g_array_set_size (stroke, 0);
+}
+
+
+/*
+ * whether the segment from the last sample to the prim can touch the area
+ */
+static gboolean segment_visible (GArray *stroke, GromitPrim *prim, const GdkRectangle *area)
+{
+  GromitStrokeSample *last = &g_array_index (stroke, GromitStrokeSample, stroke->len - 1);
+  gint r = ceil (MAX (last->width, prim->w) / 2) + 2;
+  GdkRectangle seg;
+
+  seg.x = MIN (last->x, prim->x) - r;
+  seg.y = MIN (last->y, prim->y) - r;
+  seg.width = fabs (last->x - prim->x) + 2 * r + 1;
+  seg.height = fabs (last->y - prim->y) + 2 * r + 1;
+
+  return gdk_rectangle_intersect (&seg, area, NULL);
+}
+
+
+/*
+ * Replays an op, leaving out polyline segments that cannot reach the cull
+ * area if one is given. Safe to call from tile workers.
+ */
+static void paint_op (GromitData *data, cairo_t *cr, GromitOp *op, const GdkRectangle *cull)
+{
+  GdkRectangle rect;
+  GArray *stroke;
+  guint i;
+
+  cairo_save(cr);
+
+  if(!data->composited)
+    cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+  else
+    cairo_set_antialias(cr, CAIRO_ANTIALIAS_SUBPIXEL);
+
+  if (op->type == GROMIT_OP_CLEAR)
+    {
+      cairo_set_source_rgba(cr, 0, 0, 0, 0);
+      cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+      cairo_paint(cr);
+      cairo_restore(cr);
+      return;
+    }
+
+  cairo_set_operator(cr, paint_operator (op->paint_type));
+
+  /* blend translucent strokes and highlights as a whole, as scratch_commit() did */
+  gboolean group = (op->paint_type == GROMIT_HIGHLIGHT ||
+                    (op->color.alpha < 1 && !op->has_fill &&
+                     op->paint_type != GROMIT_LASSO && op->paint_type != GROMIT_STAMP &&
+                     op->paint_type != GROMIT_FILL &&
+                     paint_operator (op->paint_type) == CAIRO_OPERATOR_OVER));
+  GdkRGBA color = op->color;
+  if (group)
+    {
+      cairo_push_group(cr);
+      cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+      color.alpha = 1;
+    }
+  gdk_cairo_set_source_rgba(cr, &color);
+
+  /* polylines are collected and filled as one outline, like live strokes */
+  stroke = g_array_new (FALSE, FALSE, sizeof (GromitStrokeSample));
+
+  for (i = 0; i < op->prims->len; ++i)
+    {
+      GromitPrim *prim = &g_array_index (op->prims, GromitPrim, i);
+
+      if (prim->type != GROMIT_PRIM_LINE)
+        paint_polyline (data, cr, op, stroke);
+      else if (cull && stroke->len > 0 && !segment_visible (stroke, prim, cull))
+        paint_polyline (data, cr, op, stroke);
+
+      switch (prim->type)
+        {
+        case GROMIT_PRIM_MOVE:
+        case GROMIT_PRIM_LINE:
+          {
+            GromitStrokeSample sample = { prim->x, prim->y, prim->w };
+            g_array_append_val (stroke, sample);
+          }
+          break;
+        case GROMIT_PRIM_ARROW:
+          paint_arrow (data, cr, &color, prim->x, prim->y, prim->w, prim->a, &rect);
+          break;
+        case GROMIT_PRIM_CIRCLE:
+          paint_circle (cr, &color, op->has_fill ? &op->fill_color : NULL,
+                        prim->x, prim->y, prim->a, prim->w);
+          break;
+        case GROMIT_PRIM_LABEL:
+          if (op->label)
+            paint_string_label (data, cr, prim->x, prim->y, op->label, prim->w, &rect);
+          break;
+        case GROMIT_PRIM_TEXT:
+          if (op->label)
+            paint_text (data, cr, prim->x, prim->y, op->label, prim->w);
+          break;
+        case GROMIT_PRIM_STAMP:
+          if (op->image)
+            stamp_paint (data, cr, op->image, prim->x, prim->y, prim->w, &rect);
+          break;
+        case GROMIT_PRIM_MASK:
+          if (op->mask)
+            cairo_mask_surface (cr, op->mask, prim->x, prim->y);
+          break;
+        case GROMIT_PRIM_RIM:
+          /* below the antialiased edge of the outline, so it meets the ink without covering it */
+          if (op->rim)
+            {
+              cairo_save (cr);
+              cairo_set_operator (cr, CAIRO_OPERATOR_DEST_OVER);
+              cairo_mask_surface (cr, op->rim, prim->x, prim->y);
+              cairo_restore (cr);
+            }
+          break;
+        case GROMIT_PRIM_LIFT:
+          if (op->mask)
+            {
+              cairo_save (cr);
+              cairo_set_source_rgba (cr, 0, 0, 0, 1);
+              cairo_set_operator (cr, CAIRO_OPERATOR_DEST_OUT);
+              cairo_mask_surface (cr, op->mask, prim->x, prim->y);
+              cairo_restore (cr);
+            }
+          break;
+        case GROMIT_PRIM_PASTE:
+          if (op->layer)
+            {
+              cairo_save (cr);
+              cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+              cairo_set_source_surface (cr, op->layer, prim->x, prim->y);
+              cairo_paint (cr);
+              cairo_restore (cr);
+            }
+          break;
+        }
+    }
+
+  paint_polyline (data, cr, op, stroke);
+  g_array_free (stroke, TRUE);
+
+  if (group)
+    {
+      cairo_pop_group_to_source(cr);
+      cairo_paint_with_alpha(cr, op->color.alpha);
+    }
+
+  cairo_restore(cr);
+}
+
+
+/*
+ * replay a recorded op onto the given context, which is left unchanged
+ */
+void draw_op (GromitData *data, cairo_t *cr, GromitOp *op)
+{
+  paint_op (data, cr, op, NULL);
+}
+
+
+typedef struct
+{
+  GMutex   lock;
+  GCond    done;
+  guint    pending;
+} GromitTileBatch;
+
+typedef struct
+{
+  GromitData      *data;
+  GromitTileBatch *batch;
+  cairo_surface_t *target;
+  GromitOp       **ops;
+  guint            n_ops;
+  GdkRectangle     tile;
+} GromitTileJob;
+
+
+/*
+ * renders the ops into one tile of the target, runs on a pool thread
+ */
+static void draw_tile (gpointer job_data, gpointer user_data)
+{
+  GromitTileJob *job = job_data;
+  cairo_surface_t *target = job->target;
+  gint stride = cairo_image_surface_get_stride (target);
+  gdouble sx, sy, ox, oy;
+  guint i;
+
+  /* tiles are in logical pixels, the target may be hi-dpi and offset */
+  cairo_surface_get_device_scale (target, &sx, &sy);
+  cairo_surface_get_device_offset (target, &ox, &oy);
+  gint scale = sx;
+
+  /* a surface of its own, aliasing the tile's pixels */
+  cairo_surface_t *tile =
+    cairo_image_surface_create_for_data (cairo_image_surface_get_data (target)
+                                         + (gsize) (job->tile.y * scale + (gint) oy) * stride
+                                         + (job->tile.x * scale + (gint) ox) * 4,
+                                         CAIRO_FORMAT_ARGB32,
+                                         job->tile.width * scale, job->tile.height * scale,
+                                         stride);
+  cairo_surface_set_device_scale (tile, scale, scale);
+  cairo_surface_set_device_offset (tile, -job->tile.x * scale, -job->tile.y * scale);
+
+  cairo_t *cr = cairo_create (tile);
+  gdk_cairo_rectangle (cr, &job->tile);
+  cairo_clip (cr);
+
+  for (i = 0; i < job->n_ops; ++i)
+    paint_op (job->data, cr, job->ops[i], &job->tile);
+
+  cairo_destroy (cr);
+  cairo_surface_finish (tile);
+  cairo_surface_destroy (tile);
+
+  g_mutex_lock (&job->batch->lock);
+  if (--job->batch->pending == 0)
+    g_cond_signal (&job->batch->done);
+  g_mutex_unlock (&job->batch->lock);
+}
+
+
+/*
+ * Replays the ops into the given region of an ARGB32 image surface. Large
+ * regions are split into tiles rendered in parallel on data->tile_pool.
+ * Returns when all of them are done.
+ */
+void draw_ops_tiled (GromitData *data,
+                     cairo_surface_t *target,
+                     GromitOp **ops, guint n_ops,
+                     GdkRectangle *rect)
+{
+  gdouble sx, sy, ox, oy;
+  cairo_surface_get_device_scale (target, &sx, &sy);
+  cairo_surface_get_device_offset (target, &ox, &oy);
+  GdkRectangle area = { -ox / sx, -oy / sy,
+                        cairo_image_surface_get_width (target) / sx,
+                        cairo_image_surface_get_height (target) / sy };
+  GromitTileBatch batch;
+  GromitTileJob *jobs;
+  guint cols, rows, i;
+
+  if (n_ops == 0 || !gdk_rectangle_intersect (rect, &area, &area))
+    return;
+
+  cols = (area.width + GROMIT_TILE_SIZE - 1) / GROMIT_TILE_SIZE;
+  rows = (area.height + GROMIT_TILE_SIZE - 1) / GROMIT_TILE_SIZE;
+
+  if (cols * rows < 2 || g_get_num_processors () < 2)
+    {
+      cairo_t *cr = cairo_create (target);
+      gdk_cairo_rectangle (cr, &area);
+      cairo_clip (cr);
+      for (i = 0; i < n_ops; ++i)
+        draw_op (data, cr, ops[i]);
+      cairo_destroy (cr);
+      return;
+    }
+
+  if (!data->tile_pool)
+    data->tile_pool = g_thread_pool_new (draw_tile, NULL,
+                                         g_get_num_processors (), FALSE, NULL);
+
+  cairo_surface_flush (target);
+
+  g_mutex_init (&batch.lock);
+  g_cond_init (&batch.done);
+  batch.pending = cols * rows;
+
+  jobs = g_new (GromitTileJob, cols * rows);
+  for (i = 0; i < cols * rows; ++i)
+    {
+      GromitTileJob *job = &jobs[i];
+      job->data = data;
+      job->batch = &batch;
+      job->target = target;
+      job->ops = ops;
+      job->n_ops = n_ops;
+      job->tile.x = area.x + (i % cols) * GROMIT_TILE_SIZE;
+      job->tile.y = area.y + (i / cols) * GROMIT_TILE_SIZE;
+      job->tile.width = MIN (GROMIT_TILE_SIZE, area.x + area.width - job->tile.x);
+      job->tile.height = MIN (GROMIT_TILE_SIZE, area.y + area.height - job->tile.y);
+      g_thread_pool_push (data->tile_pool, job, NULL);
+    }
+
+  g_mutex_lock (&batch.lock);
+  while (batch.pending > 0)
+    g_cond_wait (&batch.done, &batch.lock);
+  g_mutex_unlock (&batch.lock);
+
+  g_free (jobs);
+  g_mutex_clear (&batch.lock);
+  g_cond_clear (&batch.done);
+
+  cairo_surface_mark_dirty_rectangle (target, area.x * sx + ox, area.y * sy + oy,
+                                      area.width * sx, area.height * sy);
+
+  if(data->debug)
+    g_printerr("DEBUG: Rendered %u ops in %u tiles.\n", n_ops, cols * rows);
+}
+
+
+static cairo_surface_t *scratch_surface_new (GromitData *data, gint width, gint height)
+{
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                         width * data->scale,
+                                                         height * data->scale);
+  cairo_surface_set_device_scale (surface, data->scale, data->scale);
+
+  if(data->debug)
+    g_printerr("DEBUG: Allocated scratch surface of %dx%d.\n", width, height);
+
+  return surface;
+}
+
+
+/*
+ * moves area into the window as far as it fits and the surface there
+ */
+static void scratch_place (GromitData *data, cairo_surface_t *surface, GdkRectangle *area)
+{
+  area->x = MAX (MIN (area->x, (gint) data->width - area->width), 0);
+  area->y = MAX (MIN (area->y, (gint) data->height - area->height), 0);
+  cairo_surface_set_device_offset (surface, -area->x * data->scale, -area->y * data->scale);
+}
+
+
+static void scratch_ctx_setup (GromitDeviceData *devdata, cairo_antialias_t antialias)
+{
+  gdk_cairo_set_source_rgba (devdata->scratch_ctx, &devdata->scratch_color);
+  cairo_set_antialias (devdata->scratch_ctx, antialias);
+  cairo_set_operator (devdata->scratch_ctx, CAIRO_OPERATOR_OVER);
+}
+
+
+/*
+ * starts a stroke of the device, on a scratch surface if its colour is translucent
+ */
+void scratch_begin (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitPaintContext *context = devdata->cur_context;
+
+  if (devdata->scratch_ctx)
+    scratch_commit (data, devdata);
+
+  /*
+    Without compositing there is no translucency to preserve. Fading ink
+    always stays apart, highlights are multiplied onto the backbuffer once.
+  */
+  if (context->type != GROMIT_LASER && context->type != GROMIT_HIGHLIGHT &&
+      (!data->composited ||
+       context->paint_color->alpha >= 1 || context->fill_color ||
+       paint_operator (context->type) != CAIRO_OPERATOR_OVER))
+    return;
+
+  GdkRectangle area = { devdata->lastx, devdata->lasty, GROMIT_TILE_SIZE, GROMIT_TILE_SIZE };
+
+  if (data->scratch_pool)
+    {
+      devdata->scratch = data->scratch_pool->data;
+      data->scratch_pool = g_slist_delete_link (data->scratch_pool, data->scratch_pool);
+      area.width = cairo_image_surface_get_width (devdata->scratch) / data->scale;
+      area.height = cairo_image_surface_get_height (devdata->scratch) / data->scale;
+    }
+  else
+    devdata->scratch = scratch_surface_new (data, area.width, area.height);
+
+  /* centered on the press point */
+  area.x -= area.width / 2;
+  area.y -= area.height / 2;
+  scratch_place (data, devdata->scratch, &area);
+  devdata->scratch_area = area;
+
+  devdata->scratch_ctx = cairo_create (devdata->scratch);
+  devdata->scratch_color = *context->paint_color;
+  devdata->scratch_alpha = context->paint_color->alpha;
+  devdata->scratch_color.alpha = 1;
+  scratch_ctx_setup (devdata, cairo_get_antialias (paint_context_cairo (data, context)));
+  devdata->scratch_rect.width = devdata->scratch_rect.height = 0;
+}
+
+
+/*
+ * Makes the device's scratch surface cover rect, in window coordinates.
+ * When a stroke leaves the surface it is replaced by one at least twice
+ * as wide or high, up to the size of the window, keeping what is drawn.
+ */
+static void scratch_reserve (GromitData *data, GromitDeviceData *devdata, GdkRectangle *rect)
+{
+  GdkRectangle screen = { 0, 0, data->width, data->height };
+  GdkRectangle need, area;
+
+  if (!devdata->scratch_ctx || !gdk_rectangle_intersect (rect, &screen, &need))
+    return;
+
+  gdk_rectangle_union (&need, &devdata->scratch_area, &need);
+  if (need.width == devdata->scratch_area.width && need.height == devdata->scratch_area.height)
+    return;
+
+  area.width = MIN (MAX (need.width, 2 * devdata->scratch_area.width), screen.width);
+  area.height = MIN (MAX (need.height, 2 * devdata->scratch_area.height), screen.height);
+  area.x = need.x - (area.width - need.width) / 2;
+  area.y = need.y - (area.height - need.height) / 2;
+
+  cairo_surface_t *surface = scratch_surface_new (data, area.width, area.height);
+  scratch_place (data, surface, &area);
+
+  /* both are placed by their device offsets */
+  cairo_t *cr = cairo_create (surface);
+  cairo_set_source_surface (cr, devdata->scratch, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  cairo_antialias_t antialias = cairo_get_antialias (devdata->scratch_ctx);
+  cairo_destroy (devdata->scratch_ctx);
+  cairo_surface_destroy (devdata->scratch);
+
+  devdata->scratch = surface;
+  devdata->scratch_area = area;
+  devdata->scratch_ctx = cairo_create (surface);
+  scratch_ctx_setup (devdata, antialias);
+}
+
+
+/*
+ * throws away what was drawn on the scratch surface so far
+ */
+void scratch_reset (GromitData *data, GromitDeviceData *devdata)
+{
+  cairo_t *cr = devdata->scratch_ctx;
+
+  if (!cr || devdata->scratch_rect.width <= 0)
+    return;
+
+  cairo_save (cr);
+  gdk_cairo_rectangle (cr, &devdata->scratch_rect);
+  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+  cairo_fill (cr);
+  cairo_restore (cr);
+
+  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &devdata->scratch_rect, 0);
+  devdata->scratch_rect.width = devdata->scratch_rect.height = 0;
+}
+
+
+/*
+ * Fading strokes keep a copy of their part of the scratch surface. Each
+ * frame only strokes whose 8 bit opacity changed are redrawn, the queue is
+ * sorted by the time strokes vanish, so expired ones are always at its head.
+ */
+struct _GromitFade
+{
+  cairo_surface_t *surface; /* the size of rect */
+  GdkRectangle     rect;
+  gdouble          alpha;
+  gint64           start;
+  gint64           end;
+  guint8           level;  /* current opacity, 255 is alpha */
+};
+
+
+static void scratch_release (GromitData *data, cairo_surface_t *surface)
+{
+  gdouble sx, sy;
+
+  /* drop surfaces left over from before a scale change */
+  cairo_surface_get_device_scale (surface, &sx, &sy);
+  if (sx == data->scale)
+    data->scratch_pool = g_slist_prepend (data->scratch_pool, surface);
+  else
+    cairo_surface_destroy (surface);
+}
+
+
+static void fade_push (GromitData *data, GromitDeviceData *devdata);
+
+
+/*
+ * blends the scratch surface into the backbuffer and returns it to the pool
+ */
+void scratch_commit (GromitData *data, GromitDeviceData *devdata)
+{
+  if (!devdata->scratch_ctx)
+    return;
+
+  if (devdata->cur_context->type == GROMIT_LASER)
+    fade_push (data, devdata);
+  else if (devdata->scratch_rect.width > 0)
+    {
+      cairo_t *cr = cairo_create (data->backbuffer);
+      gdk_cairo_rectangle (cr, &devdata->scratch_rect);
+      cairo_clip (cr);
+      cairo_set_source_surface (cr, devdata->scratch, 0, 0);
+      cairo_set_operator (cr, paint_operator (devdata->cur_context->type));
+      cairo_paint_with_alpha (cr, devdata->scratch_alpha);
+      cairo_destroy (cr);
+
+      data->modified = 1;
+      scratch_reset (data, devdata);
+    }
+
+  cairo_destroy (devdata->scratch_ctx);
+  devdata->scratch_ctx = NULL;
+
+  scratch_release (data, devdata->scratch);
+  devdata->scratch = NULL;
+}
+
+
+/*
+ * shows the strokes in progress on top of the backbuffer
+ */
+void scratch_expose (GromitData *data, cairo_t *cr)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitDeviceData *devdata = value;
+      GdkRectangle rect = devdata->scratch_rect, predicted;
+      gboolean predict;
+
+      if (!devdata->scratch_ctx)
+        continue;
+
+      predict = predict_area (devdata, &predicted);
+      if (predict && rect.width > 0)
+        gdk_rectangle_union (&rect, &predicted, &rect);
+      else if (predict)
+        rect = predicted;
+      if (rect.width <= 0)
+        continue;
+
+      cairo_save (cr);
+      gdk_cairo_rectangle (cr, &rect);
+      cairo_clip (cr);
+      if (predict)
+        {
+          /* the guess is blended together with the ink, not on top of it */
+          cairo_push_group (cr);
+          cairo_set_source_surface (cr, devdata->scratch, 0, 0);
+          cairo_paint (cr);
+          gdk_cairo_set_source_rgba (cr, &devdata->scratch_color);
+          predict_stroke (devdata, cr);
+          cairo_pop_group_to_source (cr);
+        }
+      else
+        cairo_set_source_surface (cr, devdata->scratch, 0, 0);
+      cairo_set_operator (cr, paint_operator (devdata->cur_context->type));
+      cairo_paint_with_alpha (cr, devdata->scratch_alpha);
+      cairo_restore (cr);
+    }
+}
+
+
+/* surface is placed at (x,y) */
+static void shape_union_surface (cairo_region_t *region, cairo_surface_t *surface,
+                                 gint x, gint y, GdkRectangle *rect)
+{
+  cairo_surface_t *mask = cairo_image_surface_create (CAIRO_FORMAT_A1, rect->width, rect->height);
+  cairo_t *cr = cairo_create (mask);
+  cairo_set_source_surface (cr, surface, x - rect->x, y - rect->y);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  cairo_region_t *r = gdk_cairo_region_create_from_surface (mask);
+  cairo_region_translate (r, rect->x, rect->y);
+  cairo_region_union (region, r);
+  cairo_region_destroy (r);
+  cairo_surface_destroy (mask);
+}
+
+
+/*
+ * adds the scratch surfaces of strokes in progress to the window shape
+ * used without compositing
+ */
+void scratch_shape (GromitData *data, cairo_region_t *region)
+{
+  GHashTableIter it;
+  gpointer value;
+  GList *ptr;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitDeviceData *devdata = value;
+      if (devdata->scratch_ctx && devdata->scratch_rect.width > 0)
+        shape_union_surface (region, devdata->scratch, 0, 0, &devdata->scratch_rect);
+    }
+
+  for (ptr = data->fades ? data->fades->head : NULL; ptr; ptr = ptr->next)
+    {
+      GromitFade *fade = ptr->data;
+      shape_union_surface (region, fade->surface, fade->rect.x, fade->rect.y, &fade->rect);
+    }
+}
+
+
+/*
+ * whether something besides the backbuffer has to be shown
+ */
+gboolean scratch_active (GromitData *data)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  if (data->fades && !g_queue_is_empty (data->fades))
+    return TRUE;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    if (((GromitDeviceData *) value)->scratch_ctx ||
+        ((GromitDeviceData *) value)->spotlight ||
+        ((GromitDeviceData *) value)->lens ||
+        ((GromitDeviceData *) value)->lasso ||
+        ((GromitDeviceData *) value)->text ||
+        ((GromitDeviceData *) value)->predict)
+      return TRUE;
+
+  return FALSE;
+}
+
+
+static gint fade_compare (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const GromitFade *fa = a, *fb = b;
+  return fa->end < fb->end ? -1 : fa->end > fb->end;
+}
+
+
+static void fade_free (GromitFade *fade)
+{
+  cairo_surface_destroy (fade->surface);
+  g_free (fade);
+}
+
+
+static gboolean fade_tick (GtkWidget *widget, GdkFrameClock *clock, gpointer user_data)
+{
+  GromitData *data = (GromitData *) user_data;
+  GdkWindow *window = gtk_widget_get_window (data->win);
+  gint64 now = gdk_frame_clock_get_frame_time (clock);
+  GromitFade *fade;
+  GList *ptr;
+
+  while ((fade = g_queue_peek_head (data->fades)) && fade->end <= now)
+    {
+      g_queue_pop_head (data->fades);
+      gdk_window_invalidate_rect (window, &fade->rect, 0);
+      fade_free (fade);
+      data->modified = 1;
+    }
+
+  /* the shape is either on or off, nothing in between to animate */
+  if (data->composited)
+    for (ptr = data->fades->head; ptr; ptr = ptr->next)
+      {
+        fade = ptr->data;
+        guint8 level = 255 * (fade->end - now) / (fade->end - fade->start);
+        if (level != fade->level)
+          {
+            fade->level = level;
+            gdk_window_invalidate_rect (window, &fade->rect, 0);
+          }
+      }
+
+  if (!g_queue_is_empty (data->fades))
+    return G_SOURCE_CONTINUE;
+
+  data->fade_tick = 0;
+  return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * hands the finished stroke on the scratch surface over to the fade queue
+ */
+static void fade_push (GromitData *data, GromitDeviceData *devdata)
+{
+  GdkFrameClock *clock = gtk_widget_get_frame_clock (data->win);
+  GromitFade *fade;
+
+  if (devdata->scratch_rect.width <= 0 || !clock)
+    {
+      scratch_reset (data, devdata);
+      return;
+    }
+
+  fade = g_new (GromitFade, 1);
+  fade->rect = devdata->scratch_rect;
+  fade->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                              fade->rect.width * data->scale,
+                                              fade->rect.height * data->scale);
+  cairo_surface_set_device_scale (fade->surface, data->scale, data->scale);
+
+  cairo_t *cr = cairo_create (fade->surface);
+  cairo_set_source_surface (cr, devdata->scratch, -fade->rect.x, -fade->rect.y);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+
+  fade->alpha = devdata->scratch_alpha;
+  fade->start = gdk_frame_clock_get_frame_time (clock);
+  fade->end = fade->start + devdata->cur_context->fade * G_USEC_PER_SEC;
+  fade->level = 255;
+
+  /* the scratch surface is cleaned for its next user */
+  scratch_reset (data, devdata);
+
+  if (!data->fades)
+    data->fades = g_queue_new ();
+  g_queue_insert_sorted (data->fades, fade, fade_compare, NULL);
+
+  if (!data->fade_tick)
+    data->fade_tick = gtk_widget_add_tick_callback (data->win, fade_tick, data, NULL);
+
+  if(data->debug)
+    g_printerr("DEBUG: Fading out stroke of %dx%d, %u fading.\n",
+               fade->rect.width, fade->rect.height, g_queue_get_length (data->fades));
+}
+
+
+/*
+ * shows the fading strokes at their current opacity
+ */
+void fade_expose (GromitData *data, cairo_t *cr)
+{
+  GList *ptr;
+
+  for (ptr = data->fades ? data->fades->head : NULL; ptr; ptr = ptr->next)
+    {
+      GromitFade *fade = ptr->data;
+
+      cairo_save (cr);
+      gdk_cairo_rectangle (cr, &fade->rect);
+      cairo_clip (cr);
+      cairo_set_source_surface (cr, fade->surface, fade->rect.x, fade->rect.y);
+      cairo_paint_with_alpha (cr, fade->alpha * fade->level / 255);
+      cairo_restore (cr);
+    }
+}
+
+
+/*
+ * removes all fading strokes at once
+ */
+void fade_clear (GromitData *data)
+{
+  GromitFade *fade;
+
+  if (!data->fades)
+    return;
+
+  while ((fade = g_queue_pop_head (data->fades)))
+    {
+      gdk_window_invalidate_rect (gtk_widget_get_window (data->win), &fade->rect, 0);
+      fade_free (fade);
+    }
+
+  if (data->fade_tick)
+    {
+      gtk_widget_remove_tick_callback (data->win, data->fade_tick);
+      data->fade_tick = 0;
+    }
+}
+
+
+struct _GromitSpotlight
+{
+  GdkRGBA      color;
+  gdouble      x, y;
+  gdouble      radius;
+  gboolean     rect;
+  GdkRectangle hole;   /* covers the antialiased edge as well */
+};
+
+
+static void spotlight_hole (GromitSpotlight *spot, GdkRectangle *rect)
+{
+  rect->x = floor (spot->x - spot->radius) - 1;
+  rect->y = floor (spot->y - spot->radius) - 1;
+  rect->width = rect->height = ceil (2 * spot->radius) + 3;
+}
+
+
+/*
+ * starts the device's spotlight or moves it to (x,y)
+ */
+void spotlight_move (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y)
+{
+  GdkWindow *window = gtk_widget_get_window (data->win);
+  GromitSpotlight *spot = devdata->spotlight;
+
+  if (!spot)
+    {
+      GromitPaintContext *context = devdata->cur_context;
+
+      spot = devdata->spotlight = g_new (GromitSpotlight, 1);
+      spot->color = *context->paint_color;
+      spot->radius = MAX (context->radius, 1);
+      spot->rect = context->spot_rect;
+      spot->x = x;
+      spot->y = y;
+      spotlight_hole (spot, &spot->hole);
+
+      /* the only full redraw, the dimmed area does not change later */
+      gtk_widget_queue_draw (data->win);
+      return;
+    }
+
+  gdk_window_invalidate_rect (window, &spot->hole, 0);
+  spot->x = x;
+  spot->y = y;
+  spotlight_hole (spot, &spot->hole);
+  gdk_window_invalidate_rect (window, &spot->hole, 0);
+}
+
+
+void spotlight_end (GromitData *data, GromitDeviceData *devdata)
+{
+  if (!devdata->spotlight)
+    return;
+
+  g_free (devdata->spotlight);
+  devdata->spotlight = NULL;
+  gtk_widget_queue_draw (data->win);
+}
+
+
+/*
+ * dims the exposed area except for the holes of all spotlights
+ */
+void spotlight_expose (GromitData *data, cairo_t *cr)
+{
+  GHashTableIter it;
+  gpointer value;
+  GromitSpotlight *first = NULL;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    if ((first = ((GromitDeviceData *) value)->spotlight))
+      break;
+
+  if (!first)
+    return;
+
+  /* the group only spans the clip, i.e. the holes when one moved */
+  cairo_save (cr);
+  cairo_push_group (cr);
+  gdk_cairo_set_source_rgba (cr, &first->color);
+  cairo_paint (cr);
+
+  cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitSpotlight *spot = ((GromitDeviceData *) value)->spotlight;
+      if (!spot)
+        continue;
+      if (spot->rect)
+        cairo_rectangle (cr, spot->x - spot->radius, spot->y - spot->radius,
+                         2 * spot->radius, 2 * spot->radius);
+      else
+        {
+          cairo_new_sub_path (cr);
+          cairo_arc (cr, spot->x, spot->y, spot->radius, 0, 2 * M_PI);
+        }
+    }
+  cairo_set_fill_rule (cr, CAIRO_FILL_RULE_WINDING);
+  cairo_fill (cr);
+
+  cairo_pop_group_to_source (cr);
+  cairo_paint (cr);
+  cairo_restore (cr);
+}
+
+
+void scratch_pool_clear (GromitData *data)
+{
+  g_slist_free_full (data->scratch_pool, (GDestroyNotify) cairo_surface_destroy);
+  data->scratch_pool = NULL;
+}
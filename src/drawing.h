@@ -8,18 +8,89 @@
 
 #include "main.h"
 
+/* a point of a stroke as sampled, at subpixel precision */
 typedef struct
 {
-  gint x;
-  gint y;
-  gint width;
+  gfloat x;
+  gfloat y;
+  gfloat width;
 } GromitStrokeCoordinate;
 
+/* one pressure sample of a freehand stroke, see draw_stroke() */
+typedef struct
+{
+  gfloat x;
+  gfloat y;
+  gfloat width;
+} GromitStrokeSample;
+
 
-void draw_line (GromitData *data, GdkDevice *dev, gint x1, gint y1, gint x2, gint y2);
-void draw_arrow (GromitData *data, GdkDevice *dev, gint x1, gint y1, gfloat width, gfloat direction);
-void draw_circle (GromitData *data, GdkDevice *dev, gint x, gint y, gfloat radius);
-void draw_length_label (GromitData *data, GdkDevice *dev, gint x1, gint y1, gint x2, gint y2);
+void draw_line (GromitData *data, GdkDevice *dev, gdouble x1, gdouble y1, gdouble x2, gdouble y2);
+void draw_arrow (GromitData *data, GdkDevice *dev, gdouble x1, gdouble y1, gfloat width, gfloat direction);
+void draw_circle (GromitData *data, GdkDevice *dev, gdouble x, gdouble y, gfloat radius);
+void draw_length_label (GromitData *data, GdkDevice *dev, gdouble x1, gdouble y1, gdouble x2, gdouble y2);
 void draw_string_label (GromitData *data, GdkDevice *dev, gint x, gint y, char *string);
+void draw_stroke (GromitData *data, GdkDevice *dev, GromitStrokeSample *samples, guint n);
+void draw_fill (GromitData *data, GdkDevice *dev, gint x, gint y);
+void draw_op (GromitData *data, cairo_t *cr, GromitOp *op);
+
+/* how much each channel of a pixel may differ from the seed to be filled */
+#define GROMIT_FILL_TOLERANCE 48
+/* bound of the fill's seed stack, past it the fill stops growing */
+#define GROMIT_FILL_MAX_SEEDS (1 << 20)
+
+/* edge length of the tiles batch redraws are split into */
+#define GROMIT_TILE_SIZE 256
+/* strokes with at least this many samples are drawn tiled */
+#define GROMIT_TILE_MIN_SAMPLES 512
+
+void draw_ops_tiled (GromitData *data, cairo_surface_t *target,
+                     GromitOp **ops, guint n_ops, GdkRectangle *rect);
+
+/*
+  Strokes in a translucent colour are painted opaque into a scratch surface
+  taken from a pool and blended into the backbuffer once on button release,
+  so overlapping parts of one stroke do not darken each other. Until then
+  on_expose blends the scratch surfaces on top of the backbuffer.
+  A scratch surface starts at one tile around the press point and doubles
+  in size whenever the stroke leaves it, its position in the window is
+  its device offset.
+*/
+void scratch_begin (GromitData *data, GromitDeviceData *devdata);
+void scratch_reset (GromitData *data, GromitDeviceData *devdata);
+void scratch_commit (GromitData *data, GromitDeviceData *devdata);
+void scratch_expose (GromitData *data, cairo_t *cr);
+void scratch_shape (GromitData *data, cairo_region_t *region);
+gboolean scratch_active (GromitData *data);
+void scratch_pool_clear (GromitData *data);
+
+/*
+  LASER strokes are not committed but fade out from their scratch surface
+  within the tool's fade time, driven by the frame clock.
+*/
+void fade_expose (GromitData *data, cairo_t *cr);
+void fade_clear (GromitData *data);
+
+/*
+  SPOTLIGHT dims the screen around a hole at the pointer while a button is
+  down. It is drawn over everything on expose and never touches the
+  backbuffer, moving it only redraws the old and new hole.
+*/
+void spotlight_move (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y);
+void spotlight_end (GromitData *data, GromitDeviceData *devdata);
+void spotlight_expose (GromitData *data, cairo_t *cr);
+
+/*
+  TEXT is typed on the keyboard belonging to the pointer that clicked.
+  Each character is masked onto the backbuffer from the label glyph cache
+  and only its glyph is redrawn; what a glyph covered is kept so backspace
+  can put it back. The whole text becomes one op when it is finished.
+*/
+void text_begin (GromitData *data, GromitDeviceData *devdata, gint x, gint y);
+gboolean text_key (GromitData *data, GromitDeviceData *devdata, guint keyval);
+void text_end (GromitData *data, GromitDeviceData *devdata);
+void text_end_all (GromitData *data);
+void text_expose (GromitData *data, cairo_t *cr);
+void text_shape (GromitData *data, cairo_region_t *region);
 
 #endif
@@ -16,6 +16,11 @@
 #define WAYLAND_HOTKEY_PREFIX "gromit-mpx-wayland-hotkey"
 
 #include "input.h"
+#include "drawing.h"
+#include "lasso.h"
+#include "lens.h"
+#include "predict.h"
+#include "undo.h"
 
 
 static gboolean get_are_all_grabbed(GromitData *data)
@@ -224,7 +229,17 @@ void setup_input_devices (GromitData *data)
   gpointer value;
   g_hash_table_iter_init (&it, data->devdatatable);
   while (g_hash_table_iter_next (&it, NULL, &value)) 
-    g_free(value);
+    {
+      /* keep what was painted by an unfinished stroke undoable */
+      scratch_commit (data, value);
+      undo_op_commit (data, value);
+      spotlight_end (data, value);
+      lens_end (data, value);
+      lasso_end (data, value);
+      text_end (data, value);
+      predict_end (data, value);
+      g_free(value);
+    }
   g_hash_table_remove_all(data->devdatatable);
 
 
@@ -412,6 +427,11 @@ void release_grab (GromitData *data,
             /* workaround buggy GTK3 ? */
 	    devdata->motion_time = 0;
 	  }
+          spotlight_end (data, devdata);
+          lens_end (data, devdata);
+          lasso_end (data, devdata);
+          text_end (data, devdata);
+          predict_end (data, devdata);
         }
 
       if(data->debug)
@@ -435,6 +455,11 @@ void release_grab (GromitData *data,
       devdata->is_grabbed = 0;
       /* workaround buggy GTK3 ? */
       devdata->motion_time = 0;
+      spotlight_end (data, devdata);
+      lens_end (data, devdata);
+      lasso_end (data, devdata);
+      text_end (data, devdata);
+      predict_end (data, devdata);
 
 
       if(data->debug)
@@ -618,9 +643,9 @@ gint snoop_key_press(GtkWidget   *grab_widget,
       if (data->hidden)
         return FALSE;
       if (event->state & GDK_SHIFT_MASK)
-        redo_drawing (data);
+        redo_drawing (data, dev);
       else
-        undo_drawing (data);
+        undo_drawing (data, dev);
 
       return TRUE;
     }
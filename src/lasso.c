@@ -0,0 +1,365 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <math.h>
+#include "lasso.h"
+#include "drawing.h"
+#include "undo.h"
+
+struct _GromitLasso
+{
+  GArray          *path;      /* of GdkPoint, the lasso as drawn */
+  GdkRectangle     path_rect; /* its bounds, including the outline */
+  cairo_surface_t *mask;      /* A8 of the enclosed area, box sized */
+  cairo_surface_t *layer;     /* the enclosed pixels, box sized */
+  GdkRectangle     box;       /* where the layer was lifted from */
+  gint             dx, dy;    /* how far it was dragged */
+  gboolean         dragging;
+  gdouble          grab_x, grab_y;
+};
+
+
+/* the layer where it was dragged to */
+static void lasso_moved_box (GromitLasso *lasso, GdkRectangle *rect)
+{
+  *rect = lasso->box;
+  rect->x += lasso->dx;
+  rect->y += lasso->dy;
+}
+
+
+static void lasso_path (cairo_t *cr, GromitLasso *lasso)
+{
+  guint i;
+
+  for (i = 0; i < lasso->path->len; ++i)
+    {
+      GdkPoint *p = &g_array_index (lasso->path, GdkPoint, i);
+      cairo_line_to (cr, p->x + 0.5, p->y + 0.5);
+    }
+  cairo_close_path (cr);
+}
+
+
+/*
+ * lifts what the lasso encloses into the floating layer, FALSE if that is nothing
+ */
+static gboolean lasso_lift (GromitData *data, GromitLasso *lasso)
+{
+  GdkRectangle screen = { 0, 0, data->width, data->height };
+  cairo_t *cr;
+
+  /* one pixel around for the antialiased edge */
+  lasso->box.x = lasso->path_rect.x + 1;
+  lasso->box.y = lasso->path_rect.y + 1;
+  lasso->box.width = lasso->path_rect.width - 2;
+  lasso->box.height = lasso->path_rect.height - 2;
+
+  if (lasso->path->len < 3 ||
+      !gdk_rectangle_intersect (&lasso->box, &screen, &lasso->box))
+    return FALSE;
+
+  lasso->mask = cairo_image_surface_create (CAIRO_FORMAT_A8,
+                                            lasso->box.width * data->scale,
+                                            lasso->box.height * data->scale);
+  cairo_surface_set_device_scale (lasso->mask, data->scale, data->scale);
+  cr = cairo_create (lasso->mask);
+  if (!data->composited)
+    cairo_set_antialias (cr, CAIRO_ANTIALIAS_NONE);
+  cairo_translate (cr, -lasso->box.x, -lasso->box.y);
+  lasso_path (cr, lasso);
+  cairo_fill (cr);
+  cairo_destroy (cr);
+
+  lasso->layer = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                             lasso->box.width * data->scale,
+                                             lasso->box.height * data->scale);
+  cairo_surface_set_device_scale (lasso->layer, data->scale, data->scale);
+  cr = cairo_create (lasso->layer);
+  cairo_set_source_surface (cr, data->backbuffer, -lasso->box.x, -lasso->box.y);
+  cairo_mask_surface (cr, lasso->mask, 0, 0);
+  cairo_destroy (cr);
+
+  if(data->debug)
+    g_printerr("DEBUG: Lasso lifted %dx%d+%d+%d.\n",
+               lasso->box.width, lasso->box.height, lasso->box.x, lasso->box.y);
+
+  return TRUE;
+}
+
+
+/*
+ * pastes the layer where it was dragged to and records that as one op
+ */
+static void lasso_drop (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitLasso *lasso = devdata->lasso;
+  GdkRectangle moved;
+
+  if (lasso->dx == 0 && lasso->dy == 0)
+    return;
+
+  lasso_moved_box (lasso, &moved);
+
+  GromitOp *op = undo_op_new (GROMIT_OP_STROKE, devdata->cur_context);
+  op->paint_type = GROMIT_LASSO;
+  op->device = devdata->device;
+  op->has_fill = FALSE;
+  op->mask = cairo_surface_reference (lasso->mask);
+  op->layer = cairo_surface_reference (lasso->layer);
+  undo_op_add_prim (op, GROMIT_PRIM_LIFT, lasso->box.x, lasso->box.y, 0, 0, &lasso->box);
+  undo_op_add_prim (op, GROMIT_PRIM_PASTE, moved.x, moved.y, 0, 0, &moved);
+
+  cairo_t *cr = cairo_create (data->backbuffer);
+  draw_op (data, cr, op);
+  cairo_destroy (cr);
+
+  data->painted = 1;
+  undo_commit (data, op);
+}
+
+
+/*
+ * Starts dragging the device's floating layer if (x,y) is on it,
+ * otherwise drops it and starts a new lasso.
+ */
+void lasso_press (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y)
+{
+  GromitLasso *lasso = devdata->lasso;
+
+  if (lasso && lasso->layer)
+    {
+      GdkRectangle moved;
+      lasso_moved_box (lasso, &moved);
+      if (x >= moved.x && x < moved.x + moved.width &&
+          y >= moved.y && y < moved.y + moved.height)
+        {
+          lasso->dragging = TRUE;
+          lasso->grab_x = x - lasso->dx;
+          lasso->grab_y = y - lasso->dy;
+          return;
+        }
+    }
+
+  lasso_end (data, devdata);
+
+  GdkPoint p = { x, y };
+  lasso = devdata->lasso = g_new0 (GromitLasso, 1);
+  lasso->path = g_array_new (FALSE, FALSE, sizeof (GdkPoint));
+  g_array_append_val (lasso->path, p);
+  lasso->path_rect.x = p.x - 1;
+  lasso->path_rect.y = p.y - 1;
+  lasso->path_rect.width = lasso->path_rect.height = 3;
+}
+
+
+/*
+ * extends the lasso or drags the layer, redrawing only what changed
+ */
+void lasso_motion (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y)
+{
+  GdkWindow *window = gtk_widget_get_window (data->win);
+  GromitLasso *lasso = devdata->lasso;
+  GdkRectangle rect;
+
+  if (!lasso)
+    return;
+
+  if (lasso->dragging)
+    {
+      gint dx = x - lasso->grab_x, dy = y - lasso->grab_y;
+      if (dx == lasso->dx && dy == lasso->dy)
+        return;
+
+      lasso_moved_box (lasso, &rect);
+      gdk_window_invalidate_rect (window, &rect, 0);
+      lasso->dx = dx;
+      lasso->dy = dy;
+      lasso_moved_box (lasso, &rect);
+      gdk_window_invalidate_rect (window, &rect, 0);
+      data->modified = 1;
+    }
+  else if (!lasso->layer)
+    {
+      GdkPoint *last = &g_array_index (lasso->path, GdkPoint, lasso->path->len - 1);
+      GdkPoint p = { x, y };
+      if (p.x == last->x && p.y == last->y)
+        return;
+
+      /* the new segment and the one closing the lasso */
+      GdkPoint *first = &g_array_index (lasso->path, GdkPoint, 0);
+      rect.x = MIN (MIN (first->x, last->x), p.x) - 1;
+      rect.y = MIN (MIN (first->y, last->y), p.y) - 1;
+      rect.width = MAX (MAX (first->x, last->x), p.x) + 2 - rect.x;
+      rect.height = MAX (MAX (first->y, last->y), p.y) + 2 - rect.y;
+      gdk_window_invalidate_rect (window, &rect, 0);
+
+      g_array_append_val (lasso->path, p);
+      gdk_rectangle_union (&lasso->path_rect, &rect, &lasso->path_rect);
+    }
+}
+
+
+/*
+ * lifts the lasso's content or ends dragging it
+ */
+void lasso_release (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitLasso *lasso = devdata->lasso;
+
+  if (!lasso)
+    return;
+
+  if (lasso->dragging)
+    {
+      lasso_drop (data, devdata);
+      lasso_end (data, devdata);
+    }
+  else if (!lasso->layer)
+    {
+      if (!lasso_lift (data, lasso))
+        lasso_end (data, devdata);
+      else
+        {
+          gdk_window_invalidate_rect (gtk_widget_get_window (data->win), &lasso->path_rect, 0);
+          data->modified = 1;
+        }
+    }
+}
+
+
+/*
+ * forgets the device's lasso, a floating layer is dropped where it was lifted
+ */
+void lasso_end (GromitData *data, GromitDeviceData *devdata)
+{
+  GdkWindow *window = gtk_widget_get_window (data->win);
+  GromitLasso *lasso = devdata->lasso;
+
+  if (!lasso)
+    return;
+
+  gdk_window_invalidate_rect (window, &lasso->path_rect, 0);
+  if (lasso->layer)
+    {
+      GdkRectangle moved;
+      lasso_moved_box (lasso, &moved);
+      gdk_window_invalidate_rect (window, &moved, 0);
+      cairo_surface_destroy (lasso->layer);
+      cairo_surface_destroy (lasso->mask);
+      data->modified = 1;
+    }
+
+  g_array_free (lasso->path, TRUE);
+  g_free (lasso);
+  devdata->lasso = NULL;
+}
+
+
+/*
+ * drops the selections of all devices, for when the backbuffer changes under them
+ */
+void lasso_end_all (GromitData *data)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  if (!data->devdatatable)
+    return;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    lasso_end (data, value);
+}
+
+
+/*
+ * cuts the floating layers out of where they were lifted, draws them
+ * where they were dragged to and marks the lassos with dashed lines
+ */
+void lasso_expose (GromitData *data, cairo_t *cr)
+{
+  static const gdouble dash[] = { 4, 4 };
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitLasso *lasso = ((GromitDeviceData *) value)->lasso;
+      if (!lasso)
+        continue;
+
+      cairo_save (cr);
+      if (lasso->layer)
+        {
+          cairo_set_source_rgba (cr, 0, 0, 0, 1);
+          cairo_set_operator (cr, CAIRO_OPERATOR_DEST_OUT);
+          cairo_mask_surface (cr, lasso->mask, lasso->box.x, lasso->box.y);
+
+          cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+          cairo_set_source_surface (cr, lasso->layer, lasso->box.x + lasso->dx, lasso->box.y + lasso->dy);
+          cairo_paint (cr);
+          cairo_translate (cr, lasso->dx, lasso->dy);
+        }
+
+      lasso_path (cr, lasso);
+      cairo_set_line_width (cr, 1);
+      cairo_set_source_rgba (cr, 1, 1, 1, 0.8);
+      cairo_stroke_preserve (cr);
+      cairo_set_dash (cr, dash, 2, 0);
+      cairo_set_source_rgba (cr, 0, 0, 0, 0.8);
+      cairo_stroke (cr);
+      cairo_restore (cr);
+    }
+}
+
+
+/*
+ * takes the lifted areas out of the window shape used without
+ * compositing and adds the layers where they were dragged to
+ */
+void lasso_shape (GromitData *data, cairo_region_t *region)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitLasso *lasso = ((GromitDeviceData *) value)->lasso;
+      cairo_region_t *r;
+      if (!lasso || !lasso->layer)
+        continue;
+
+      r = gdk_cairo_region_create_from_surface (lasso->mask);
+      cairo_region_translate (r, lasso->box.x, lasso->box.y);
+      cairo_region_subtract (region, r);
+      cairo_region_destroy (r);
+
+      r = gdk_cairo_region_create_from_surface (lasso->layer);
+      cairo_region_translate (r, lasso->box.x + lasso->dx, lasso->box.y + lasso->dy);
+      cairo_region_union (region, r);
+      cairo_region_destroy (r);
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef LASSO_H
+#define LASSO_H
+
+/*
+  Select-and-move of the LASSO tool.
+
+  Drawing a lasso and releasing lifts the pixels it encloses into a
+  floating layer the size of the lasso's bounding box. The backbuffer
+  is not touched meanwhile, expose cuts the lifted pixels out and draws
+  the layer where it was dragged to, so dragging only redraws its old
+  and new bounds. Releasing the drag pastes the layer back as one op.
+  Pressing outside the layer or anything that changes the history drops
+  the selection unmoved.
+*/
+
+#include "main.h"
+
+void lasso_press (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y);
+void lasso_motion (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y);
+void lasso_release (GromitData *data, GromitDeviceData *devdata);
+void lasso_end (GromitData *data, GromitDeviceData *devdata);
+void lasso_end_all (GromitData *data);
+void lasso_expose (GromitData *data, cairo_t *cr);
+void lasso_shape (GromitData *data, cairo_region_t *region);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <math.h>
+#include "lens.h"
+
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <gdk/gdkx.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+struct _GromitLens
+{
+  gdouble          x, y;      /* the pointer */
+  gdouble          radius;
+  gdouble          zoom;
+  gint             scale;     /* root window pixels per logical pixel */
+  gint             size;      /* edge of the captured square in root pixels */
+  gint             cap_x;     /* where it was captured, in root pixels */
+  gint             cap_y;
+  cairo_surface_t *capture;
+  GdkRectangle     area;      /* where the lens is shown */
+#ifdef HAVE_XSHM
+  Display         *dpy;
+  XImage          *image;
+  XShmSegmentInfo  info;
+#endif
+};
+
+
+#ifdef HAVE_XSHM
+
+/*
+ * sets up an XShm segment the lens captures into, FALSE if there is none
+ */
+static gboolean lens_shm_init (GromitData *data, GromitLens *lens)
+{
+  Display *dpy;
+  GdkVisual *visual;
+
+  if (!GDK_IS_X11_DISPLAY (data->display))
+    return FALSE;
+
+  dpy = GDK_DISPLAY_XDISPLAY (data->display);
+  if (!XShmQueryExtension (dpy))
+    return FALSE;
+
+  visual = gdk_window_get_visual (data->root);
+  lens->image = XShmCreateImage (dpy, GDK_VISUAL_XVISUAL (visual), gdk_visual_get_depth (visual),
+                                 ZPixmap, NULL, &lens->info, lens->size, lens->size);
+
+  /* cairo's RGB24 is native endian 32 bit, so must be the image */
+  if (!lens->image || lens->image->bits_per_pixel != 32 ||
+      lens->image->byte_order != (G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst))
+    goto fail;
+
+  lens->info.shmid = shmget (IPC_PRIVATE, lens->image->bytes_per_line * lens->size, IPC_CREAT | 0600);
+  if (lens->info.shmid < 0)
+    goto fail;
+
+  lens->info.shmaddr = lens->image->data = shmat (lens->info.shmid, NULL, 0);
+  lens->info.readOnly = False;
+
+  if (lens->info.shmaddr == (char *) -1 || !XShmAttach (dpy, &lens->info))
+    {
+      shmctl (lens->info.shmid, IPC_RMID, NULL);
+      goto fail;
+    }
+  XSync (dpy, False);
+  shmctl (lens->info.shmid, IPC_RMID, NULL);
+
+  lens->dpy = dpy;
+  lens->capture = cairo_image_surface_create_for_data ((unsigned char *) lens->image->data,
+                                                       CAIRO_FORMAT_RGB24, lens->size, lens->size,
+                                                       lens->image->bytes_per_line);
+  return TRUE;
+
+ fail:
+  if (lens->image)
+    {
+      lens->image->data = NULL;
+      XDestroyImage (lens->image);
+      lens->image = NULL;
+    }
+  return FALSE;
+}
+
+
+static void lens_shm_free (GromitLens *lens)
+{
+  if (!lens->dpy)
+    return;
+
+  XShmDetach (lens->dpy, &lens->info);
+  XSync (lens->dpy, False);
+  lens->image->data = NULL;
+  XDestroyImage (lens->image);
+  shmdt (lens->info.shmaddr);
+}
+
+#endif
+
+
+/*
+ * grabs the part of the screen around the pointer that the lens shows
+ */
+static void lens_capture (GromitData *data, GromitLens *lens)
+{
+  gint root_width = gdk_window_get_width (data->root) * lens->scale;
+  gint root_height = gdk_window_get_height (data->root) * lens->scale;
+
+  lens->cap_x = CLAMP ((gint) (lens->x * lens->scale) - lens->size / 2, 0, MAX (root_width - lens->size, 0));
+  lens->cap_y = CLAMP ((gint) (lens->y * lens->scale) - lens->size / 2, 0, MAX (root_height - lens->size, 0));
+
+#ifdef HAVE_XSHM
+  if (lens->dpy)
+    {
+      cairo_surface_flush (lens->capture);
+      gdk_x11_display_error_trap_push (data->display);
+      XShmGetImage (lens->dpy, GDK_WINDOW_XID (data->root), lens->image,
+                    lens->cap_x, lens->cap_y, AllPlanes);
+      gdk_x11_display_error_trap_pop_ignored (data->display);
+      cairo_surface_mark_dirty (lens->capture);
+      return;
+    }
+#endif
+
+  GdkPixbuf *pixbuf = gdk_pixbuf_get_from_window (data->root,
+                                                  lens->cap_x / lens->scale, lens->cap_y / lens->scale,
+                                                  lens->size / lens->scale, lens->size / lens->scale);
+  if (!pixbuf)
+    return;
+
+  cairo_t *cr = cairo_create (lens->capture);
+  cairo_scale (cr, (gdouble) lens->size / gdk_pixbuf_get_width (pixbuf),
+               (gdouble) lens->size / gdk_pixbuf_get_height (pixbuf));
+  gdk_cairo_set_source_pixbuf (cr, pixbuf, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  g_object_unref (pixbuf);
+}
+
+
+/*
+ * Puts the lens diagonally above and right of the pointer, or on another
+ * side where the screen ends. It must not cover what it magnifies or it
+ * would capture itself.
+ */
+static void lens_place (GromitData *data, GromitLens *lens)
+{
+  gdouble offset = lens->radius + lens->size / (2.0 * lens->scale) + 4;
+  gdouble cx = lens->x + offset, cy = lens->y - offset;
+
+  if (cx + lens->radius > data->width)
+    cx = lens->x - offset;
+  if (cy - lens->radius < 0)
+    cy = lens->y + offset;
+
+  lens->area.x = floor (cx - lens->radius) - 2;
+  lens->area.y = floor (cy - lens->radius) - 2;
+  lens->area.width = lens->area.height = ceil (2 * lens->radius) + 5;
+}
+
+
+/*
+ * starts the device's lens or moves it to (x,y)
+ */
+void lens_move (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y)
+{
+  GdkWindow *window = gtk_widget_get_window (data->win);
+  GromitLens *lens = devdata->lens;
+
+  if (!lens)
+    {
+      GromitPaintContext *context = devdata->cur_context;
+
+      lens = devdata->lens = g_new0 (GromitLens, 1);
+      lens->radius = MAX (context->radius, 8);
+      lens->zoom = MAX (context->zoom, 1);
+      lens->scale = gdk_window_get_scale_factor (data->root);
+      lens->size = MAX (ceil (2 * lens->radius / lens->zoom * lens->scale), 1);
+
+#ifdef HAVE_XSHM
+      if (!lens_shm_init (data, lens))
+#endif
+        lens->capture = cairo_image_surface_create (CAIRO_FORMAT_RGB24, lens->size, lens->size);
+
+      if(data->debug)
+        g_printerr("DEBUG: Lens of radius %.0f captures %dx%d pixels.\n",
+                   lens->radius, lens->size, lens->size);
+    }
+  else
+    gdk_window_invalidate_rect (window, &lens->area, 0);
+
+  lens->x = x;
+  lens->y = y;
+  lens_capture (data, lens);
+  lens_place (data, lens);
+  gdk_window_invalidate_rect (window, &lens->area, 0);
+  /* without compositing, the window shape has to follow */
+  data->modified = 1;
+}
+
+
+void lens_end (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitLens *lens = devdata->lens;
+
+  if (!lens)
+    return;
+
+  gdk_window_invalidate_rect (gtk_widget_get_window (data->win), &lens->area, 0);
+  data->modified = 1;
+
+  cairo_surface_destroy (lens->capture);
+#ifdef HAVE_XSHM
+  lens_shm_free (lens);
+#endif
+  g_free (lens);
+  devdata->lens = NULL;
+}
+
+
+/*
+ * adds the lenses of all devices to the window shape used without
+ * compositing
+ */
+void lens_shape (GromitData *data, cairo_region_t *region)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitLens *lens = ((GromitDeviceData *) value)->lens;
+      if (!lens)
+        continue;
+
+      cairo_surface_t *mask = cairo_image_surface_create (CAIRO_FORMAT_A1, lens->area.width,
+                                                          lens->area.height);
+      cairo_t *cr = cairo_create (mask);
+      cairo_arc (cr, 2 + lens->radius, 2 + lens->radius, lens->radius + 1, 0, 2 * M_PI);
+      cairo_fill (cr);
+      cairo_destroy (cr);
+
+      cairo_region_t *r = gdk_cairo_region_create_from_surface (mask);
+      cairo_region_translate (r, lens->area.x, lens->area.y);
+      cairo_region_union (region, r);
+      cairo_region_destroy (r);
+      cairo_surface_destroy (mask);
+    }
+}
+
+
+/*
+ * draws the lenses of all devices
+ */
+void lens_expose (GromitData *data, cairo_t *cr)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitLens *lens = ((GromitDeviceData *) value)->lens;
+      if (!lens)
+        continue;
+
+      gdouble cx = lens->area.x + 2 + lens->radius;
+      gdouble cy = lens->area.y + 2 + lens->radius;
+
+      cairo_save (cr);
+      cairo_arc (cr, cx, cy, lens->radius, 0, 2 * M_PI);
+      cairo_clip (cr);
+
+      /* the pointer position in the capture ends up in the middle */
+      cairo_translate (cr, cx, cy);
+      cairo_scale (cr, lens->zoom / lens->scale, lens->zoom / lens->scale);
+      cairo_set_source_surface (cr, lens->capture,
+                                lens->cap_x - lens->x * lens->scale,
+                                lens->cap_y - lens->y * lens->scale);
+      cairo_pattern_set_filter (cairo_get_source (cr),
+                                lens->zoom >= 2 ? CAIRO_FILTER_NEAREST : CAIRO_FILTER_BILINEAR);
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+      cairo_paint (cr);
+      cairo_restore (cr);
+
+      cairo_save (cr);
+      cairo_arc (cr, cx, cy, lens->radius, 0, 2 * M_PI);
+      cairo_set_source_rgba (cr, 0, 0, 0, 0.8);
+      cairo_set_line_width (cr, 2);
+      cairo_stroke (cr);
+      cairo_restore (cr);
+    }
+}
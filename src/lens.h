@@ -0,0 +1,45 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef LENS_H
+#define LENS_H
+
+/*
+  Magnifier lens of the LENS tool.
+
+  While a LENS button is down, only the small part of the screen under
+  the pointer that the lens shows is captured from the root window on
+  each motion, via XShmGetImage() into a segment kept for the lens when
+  possible, and drawn zoomed next to the pointer. Moving the lens only
+  redraws its old and new area. Without compositing, lens_shape() adds
+  the lens to the window shape.
+*/
+
+#include "main.h"
+
+void lens_move (GromitData *data, GromitDeviceData *devdata, gdouble x, gdouble y);
+void lens_end (GromitData *data, GromitDeviceData *devdata);
+void lens_expose (GromitData *data, cairo_t *cr);
+void lens_shape (GromitData *data, cairo_region_t *region);
+
+#endif
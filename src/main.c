@@ -21,9 +21,9 @@
  *
  */
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
-#include <lz4.h>
 
 #include "callbacks.h"
 #include "config.h"
@@ -31,6 +31,11 @@
 #include "main.h"
 #include "build-config.h"
 #include "coordlist_ops.h"
+#include "drawing.h"
+#include "lasso.h"
+#include "lens.h"
+#include "present.h"
+#include "undo.h"
 
 
 
@@ -59,34 +64,211 @@ GromitPaintContext *paint_context_new (GromitData *data,
   context->minwidth = minwidth;
   context->maxwidth = maxwidth;
   context->paint_color = paint_color;
+  context->fill_color = NULL;
   context->radius = radius;
   context->maxangle = maxangle;
   context->simplify = simplify;
   context->minlen = minlen;
   context->snapdist = snapdist;
+  context->stabilize = 0;
+  context->stabilize_beta = 0.007;
   context->textsize = 14.0;
   context->showlength = 0;
+  context->fade = 2.0;
+  context->spot_rect = FALSE;
+  context->zoom = 2.0;
+  context->recognize = 0;
+  context->image = NULL;
+  context->predict = 0;
+  context->predict_samples = 4;
+  context->gamma = 1.0;
+  context->curve = NULL;
+  context->tilt = 0;
+  context->pressure_lut = NULL;
+  paint_context_pressure_lut (context);
+
+  /* created on first use, configs can define lots of unused tools */
+  context->paint_ctx = NULL;
+  context->generation = 0;
+
+  return context;
+}
+
+
+/*
+ * (re)computes the context's line width for each pressure from its
+ * widths, gamma and curve, so samples only need a lookup
+ */
+void paint_context_pressure_lut (GromitPaintContext *context)
+{
+  guint i, k = 0;
+
+  if (!context->pressure_lut)
+    context->pressure_lut = g_new (gfloat, GROMIT_PRESSURE_LUT_SIZE);
+
+  for (i = 0; i < GROMIT_PRESSURE_LUT_SIZE; ++i)
+    {
+      gdouble r = pow ((gdouble) i / (GROMIT_PRESSURE_LUT_SIZE - 1), context->gamma);
+
+      /* piecewise linear between the points, sorted by pressure */
+      if (context->curve && context->curve->len > 0)
+        {
+          GArray *c = context->curve;
+          GromitCurvePoint *p0, *p1;
+
+          while (k + 1 < c->len && g_array_index (c, GromitCurvePoint, k + 1).pressure < r)
+            ++k;
+          p0 = &g_array_index (c, GromitCurvePoint, k);
+          p1 = &g_array_index (c, GromitCurvePoint, MIN (k + 1, c->len - 1));
+          if (r <= p0->pressure || p1->pressure <= p0->pressure)
+            r = r <= p0->pressure ? p0->response : p1->response;
+          else
+            r = p0->response + (p1->response - p0->response) *
+                (r - p0->pressure) / (p1->pressure - p0->pressure);
+        }
+
+      context->pressure_lut[i] = MIN (CLAMP (r, 0, 1) *
+                                      (double) (context->width - context->minwidth) +
+                                      context->minwidth,
+                                      context->maxwidth);
+    }
+}
+
+
+/*
+ * Returns the cairo context drawing with the tool into the backbuffer,
+ * (re)creating it if there is none yet or the backbuffer was replaced.
+ */
+cairo_t *paint_context_cairo (GromitData *data, GromitPaintContext *context)
+{
+  if (context->paint_ctx && context->generation == data->backbuffer_generation)
+    return context->paint_ctx;
+
+  if (context->paint_ctx)
+    cairo_destroy (context->paint_ctx);
 
   context->paint_ctx = cairo_create (data->backbuffer);
+  context->generation = data->backbuffer_generation;
 
-  gdk_cairo_set_source_rgba(context->paint_ctx, paint_color);
+  gdk_cairo_set_source_rgba(context->paint_ctx, context->paint_color);
   if(!data->composited)
     cairo_set_antialias(context->paint_ctx, CAIRO_ANTIALIAS_NONE);
   else
     cairo_set_antialias(context->paint_ctx, CAIRO_ANTIALIAS_SUBPIXEL);
-  cairo_set_line_width(context->paint_ctx, width);
+  cairo_set_line_width(context->paint_ctx, context->width);
   cairo_set_line_cap(context->paint_ctx, CAIRO_LINE_CAP_ROUND);
   cairo_set_line_join(context->paint_ctx, CAIRO_LINE_JOIN_ROUND);
+  cairo_set_operator(context->paint_ctx, paint_operator (context->type));
 
+  return context->paint_ctx;
+}
+
+
+static void monitor_clear (gpointer ptr)
+{
+  g_object_unref (((GromitMonitor *) ptr)->monitor);
+}
+
+
+/*
+ * the current monitors, referenced so they can be recognised after a change
+ */
+GArray *monitors_new (GromitData *data)
+{
+  gint n = gdk_display_get_n_monitors (data->display);
+  GArray *monitors = g_array_sized_new (FALSE, FALSE, sizeof (GromitMonitor), n);
+  gint i;
+
+  g_array_set_clear_func (monitors, monitor_clear);
+
+  for (i = 0; i < n; ++i)
+    {
+      GromitMonitor m;
+      m.monitor = g_object_ref (gdk_display_get_monitor (data->display, i));
+      gdk_monitor_get_geometry (m.monitor, &m.geometry);
+      g_array_append_val (monitors, m);
+    }
+
+  return monitors;
+}
+
+
+/*
+ * The scale the buffers should have: the configured one, or else the
+ * highest scale factor of all monitors, so strokes are sharp on hi-dpi.
+ */
+guint canvas_scale (GromitData *data)
+{
+  guint scale = data->scale_setting;
+  guint i;
+
+  if (scale == 0)
+    {
+      scale = 1;
+      for (i = 0; data->monitors && i < data->monitors->len; ++i)
+        scale = MAX (scale, (guint) gdk_monitor_get_scale_factor (g_array_index (data->monitors, GromitMonitor, i).monitor));
+    }
+
+  return CLAMP (scale, 1, GROMIT_MAX_SCALE);
+}
+
+
+/*
+ * an empty surface the size of the screen at the current scale
+ */
+cairo_surface_t *canvas_surface_new (GromitData *data)
+{
+  cairo_surface_t *surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                         data->width * data->scale,
+                                                         data->height * data->scale);
+  cairo_surface_set_device_scale (surface, data->scale, data->scale);
+  return surface;
+}
+
+
+/*
+ * Recreates the buffers if the scale they should have changed, keeping
+ * what is drawn. The undo history starts over as its keyframes are raw
+ * pixels.
+ */
+void canvas_rescale (GromitData *data)
+{
+  guint scale = canvas_scale (data);
+
+  if (scale == data->scale)
+    return;
+
+  if(data->debug)
+    g_printerr("DEBUG: Rescaling buffers from %u to %u.\n", data->scale, scale);
+
+  data->scale = scale;
+
+  cairo_surface_t *surface = present_surface_new (data, data->width, data->height);
+  copy_surface (surface, data->backbuffer);
+  cairo_surface_destroy (data->backbuffer);
+  data->backbuffer = surface;
+
+  cairo_surface_destroy (data->aux_backbuffer);
+  data->aux_backbuffer = canvas_surface_new (data);
+
+  scratch_pool_clear (data);
+  fade_clear (data);
+  undo_init (data);
+  data->backbuffer_generation++;
+}
+
+
+cairo_operator_t paint_operator (GromitPaintType type)
+{
   if (type == GROMIT_ERASER)
-    cairo_set_operator(context->paint_ctx, CAIRO_OPERATOR_CLEAR);
+    return CAIRO_OPERATOR_CLEAR;
   else
     if (type == GROMIT_RECOLOR)
-      cairo_set_operator(context->paint_ctx, CAIRO_OPERATOR_ATOP);
+      return CAIRO_OPERATOR_ATOP;
+    else if (type == GROMIT_HIGHLIGHT)
+      return CAIRO_OPERATOR_MULTIPLY;
     else /* GROMIT_PEN */
-      cairo_set_operator(context->paint_ctx, CAIRO_OPERATOR_OVER);
-
-  return context;
+      return CAIRO_OPERATOR_OVER;
 }
 
 
@@ -112,6 +294,22 @@ void paint_context_print (gchar *name,
       g_printerr ("Recolor,    "); break;
     case GROMIT_CIRCLE:
       g_printerr ("Circle,     "); break;
+    case GROMIT_LASER:
+      g_printerr ("Laser,      "); break;
+    case GROMIT_HIGHLIGHT:
+      g_printerr ("Highlight,  "); break;
+    case GROMIT_SPOTLIGHT:
+      g_printerr ("Spotlight,  "); break;
+    case GROMIT_LENS:
+      g_printerr ("Lens,       "); break;
+    case GROMIT_FILL:
+      g_printerr ("Fill,       "); break;
+    case GROMIT_LASSO:
+      g_printerr ("Lasso,      "); break;
+    case GROMIT_TEXT:
+      g_printerr ("Text,       "); break;
+    case GROMIT_STAMP:
+      g_printerr ("Stamp,      "); break;
     default:
       g_printerr ("UNKNOWN,    "); break;
   }
@@ -145,6 +343,16 @@ void paint_context_print (gchar *name,
       g_printerr(" radius: %u, minlen: %u, maxangle: %u ",
                  context->radius, context->minlen, context->maxangle);
     }
+  if (context->recognize > 0)
+    g_printerr(" recognize: %.1f, ", context->recognize);
+  if (context->type == GROMIT_LASER)
+    g_printerr(" fade: %.2f, ", context->fade);
+  if (context->type == GROMIT_SPOTLIGHT)
+    g_printerr(" radius: %u, shape: %s, ", context->radius, context->spot_rect ? "rect" : "circle");
+  if (context->type == GROMIT_LENS)
+    g_printerr(" radius: %u, zoom: %.1f, ", context->radius, context->zoom);
+  if (context->type == GROMIT_STAMP)
+    g_printerr(" image: %s, zoom: %.1f, ", context->image ? context->image : "none", context->zoom);
   if (context->type == GROMIT_CIRCLE)
     {
       if (context->fill_color)
@@ -156,9 +364,14 @@ void paint_context_print (gchar *name,
 
 void paint_context_free (GromitPaintContext *context)
 {
-  cairo_destroy(context->paint_ctx);
+  if (context->paint_ctx)
+    cairo_destroy(context->paint_ctx);
   if (context->fill_color)
     g_free(context->fill_color);
+  g_free (context->image);
+  if (context->curve)
+    g_array_free (context->curve, TRUE);
+  g_free (context->pressure_lut);
   g_free (context);
 }
 
@@ -225,12 +438,17 @@ void toggle_visibility (GromitData *data)
 
 void clear_screen (GromitData *data)
 {
+  text_end_all (data);
+
   cairo_t *cr = cairo_create(data->backbuffer);
   cairo_set_source_rgba(cr, 0, 0, 0, 0);
   cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
   cairo_paint (cr);
   cairo_destroy(cr);
 
+  fade_clear (data);
+  lasso_end_all (data);
+
   GdkRectangle rect = {0, 0, data->width, data->height};
   gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
 
@@ -245,6 +463,8 @@ void clear_screen (GromitData *data)
       cairo_region_destroy(r);
     }
 
+  undo_commit (data, undo_op_new (GROMIT_OP_CLEAR, NULL));
+
   data->painted = 0;
 
   if(data->debug)
@@ -265,6 +485,10 @@ gint reshape (gpointer user_data)
       else
         {
 	  cairo_region_t* r = gdk_cairo_region_create_from_surface(data->backbuffer);
+	  scratch_shape(data, r);
+	  lasso_shape(data, r);
+	  lens_shape(data, r);
+	  text_shape(data, r);
 	  gtk_widget_shape_combine_region(data->win, r);
 	  cairo_region_destroy(r);
 	  // try to set transparent for input
@@ -436,28 +660,6 @@ void select_tool (GromitData *data,
 
 
 
-void snap_undo_state (GromitData *data)
-{
-  if(data->debug)
-    g_printerr ("DEBUG: Snapping undo buffer %d.\n", data->undo_head);
-
-  undo_compress(data, data->backbuffer);
-  undo_temp_buffer_to_slot(data, data->undo_head);
-
-  // Increment head position
-  data->undo_head++;
-  if(data->undo_head >= GROMIT_MAX_UNDO)
-    data->undo_head -= GROMIT_MAX_UNDO;
-  data->undo_depth++;
-  // See if we ran out of undo levels with oldest undo overwritten
-  if(data->undo_depth > GROMIT_MAX_UNDO)
-    data->undo_depth = GROMIT_MAX_UNDO;
-  // Invalidate any redo from this position
-  data->redo_depth = 0;
-}
-
-
-
 void copy_surface (cairo_surface_t *dst, cairo_surface_t *src)
 {
   cairo_t *cr = cairo_create(dst);
@@ -468,121 +670,6 @@ void copy_surface (cairo_surface_t *dst, cairo_surface_t *src)
 }
 
 
-void undo_drawing (GromitData *data)
-{
-  if(data->undo_depth <= 0)
-    return;
-  data->undo_depth--;
-  data->redo_depth++;
-  if(data->redo_depth > GROMIT_MAX_UNDO)
-    data->redo_depth -= GROMIT_MAX_UNDO;
-  data->undo_head--;
-  if(data->undo_head < 0)
-    data->undo_head += GROMIT_MAX_UNDO;
-
-  undo_compress(data, data->backbuffer);
-  undo_decompress(data, data->undo_head, data->backbuffer);
-  undo_temp_buffer_to_slot(data, data->undo_head);
-
-  GdkRectangle rect = {0, 0, data->width, data->height};
-  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
-
-  data->modified = 1;
-
-  if(data->debug)
-    g_printerr ("DEBUG: Undo drawing %d.\n", data->undo_head);
-}
-
-
-
-void redo_drawing (GromitData *data)
-{
-  if(data->redo_depth <= 0)
-    return;
-
-  undo_compress(data, data->backbuffer);
-  undo_decompress(data, data->undo_head, data->backbuffer);
-  undo_temp_buffer_to_slot(data, data->undo_head);
-
-  data->redo_depth--;
-  data->undo_depth++;
-  data->undo_head++;
-  if(data->undo_head >= GROMIT_MAX_UNDO)
-    data->undo_head -= GROMIT_MAX_UNDO;
-
-  GdkRectangle rect = {0, 0, data->width, data->height};
-  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
-
-  data->modified = 1;
-  
-  if(data->debug)
-    g_printerr("DEBUG: Redo drawing.\n");
-}
-
-/*
- * compress image data and store it in undo_temp_buffer
- *
- * the undo_temp_buffer is successively grown in case it is too small
- */
-void undo_compress(GromitData *data, cairo_surface_t *surface)
-{
-  char *raw_data = (char *)cairo_image_surface_get_data(surface);
-  guint bytes_per_row = cairo_image_surface_get_stride(surface);
-  guint rows = cairo_image_surface_get_height(surface);
-  size_t src_bytes = rows * bytes_per_row;
-
-  size_t dest_bytes;
-  for (;;)
-    {
-      dest_bytes = LZ4_compress_default(raw_data, data->undo_temp, src_bytes, data->undo_temp_size);
-      if (dest_bytes == 0)
-        {
-          data->undo_temp_size *= 2;
-          data->undo_temp = g_realloc(data->undo_temp, data->undo_temp_size);
-        }
-      else
-        {
-          data->undo_temp_used = dest_bytes;
-          break;
-        }
-    }
-}
-
-
-/*
- * copy undo_temp to undo slot, growing undo buffer if required
- */
-void undo_temp_buffer_to_slot(GromitData *data, gint undo_slot)
-{
-    const size_t required = data->undo_temp_used;
-    if (data->undo_buffer_size[undo_slot] < required)
-      {
-        data->undo_buffer[undo_slot] = g_realloc(data->undo_buffer[undo_slot], required);
-        data->undo_buffer_size[undo_slot] = required;
-      }
-    data->undo_buffer_used[undo_slot] = required;
-    memcpy(data->undo_buffer[undo_slot], data->undo_temp, required);
-}
-
-/*
- * decompress undo slot data and store it in cairo surface
- */
-void undo_decompress(GromitData *data, gint undo_slot, cairo_surface_t *surface)
-{
-  char *dest_data = (char *)cairo_image_surface_get_data(surface);
-  guint bytes_per_row = cairo_image_surface_get_stride(surface);
-  guint rows = cairo_image_surface_get_height(surface);
-  size_t dest_bytes = rows * bytes_per_row;
-
-  char *src_data = data->undo_buffer[undo_slot];
-  size_t src_bytes = data->undo_buffer_used[undo_slot];
-
-  if (LZ4_decompress_safe(src_data, dest_data, src_bytes, dest_bytes) < 0) {
-    g_printerr("Fatal error occurred decompressing image data\n");
-    exit(1);
-  }
-}
-
 /*
  * Functions for handling various (GTK+)-Events
  */
@@ -702,26 +789,17 @@ void setup_main_app (GromitData *data, int argc, char ** argv)
   */
   /* SHAPE SURFACE*/
   cairo_surface_destroy(data->backbuffer);
-  data->backbuffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, data->width, data->height);
+  data->scale = canvas_scale(data);
+  data->backbuffer = present_surface_new(data, data->width, data->height);
 
   // original state for LINE and RECT tool
   cairo_surface_destroy(data->aux_backbuffer);
-  data->aux_backbuffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, data->width, data->height);
+  data->aux_backbuffer = canvas_surface_new(data);
 
   /*
     UNDO STATE
   */
-  data->undo_head = 0;
-  data->undo_depth = 0;
-  data->redo_depth = 0;
-  data->undo_temp_size = 0x10000;
-  data->undo_temp = g_malloc(data->undo_temp_size);
-  data->undo_temp_used = 0;
-  for (int i = 0; i < GROMIT_MAX_UNDO; i++)
-    {
-      data->undo_buffer_size[i] = 0;
-      data->undo_buffer[i] = NULL;
-    }
+  undo_init (data);
 
   /* EVENTS */
   gtk_widget_add_events (data->win, GROMIT_WINDOW_EVENTS);
@@ -745,6 +823,8 @@ void setup_main_app (GromitData *data, int argc, char ** argv)
 		    G_CALLBACK (on_buttonpress), data);
   g_signal_connect (data->win, "button_release_event",
 		    G_CALLBACK (on_buttonrelease), data);
+  g_signal_connect (data->win, "key_press_event",
+		    G_CALLBACK (on_keypress), data);
   /* disconnect previously defined selection handlers */
   g_signal_handlers_disconnect_by_func (data->win,
 					G_CALLBACK (on_clientapp_selection_get),
@@ -782,6 +862,8 @@ void setup_main_app (GromitData *data, int argc, char ** argv)
   gtk_selection_add_target (data->win, GA_CONTROL, GA_UNDO, 8);
   gtk_selection_add_target (data->win, GA_CONTROL, GA_REDO, 9);
   gtk_selection_add_target (data->win, GA_CONTROL, GA_LINE, 10);
+  gtk_selection_add_target (data->win, GA_CONTROL, GA_UNDOTREE, 11);
+  gtk_selection_add_target (data->win, GA_CONTROL, GA_UNDOGOTO, 12);
 
 
 
@@ -805,6 +887,9 @@ void setup_main_app (GromitData *data, int argc, char ** argv)
 
   // might have been in key file
   gtk_widget_set_opacity(data->win, data->opacity);
+  // so might have been the scale
+  canvas_rescale(data);
+  present_update(data);
 
   /*
      FIND HOTKEY KEYCODE
@@ -1189,6 +1274,24 @@ int main_client (int argc, char **argv, GromitData *data)
          {
            action = GA_REDO;
          }
+       else if (strcmp (arg, "--undo-tree") == 0)
+         {
+           action = GA_UNDOTREE;
+         }
+       else if (strcmp (arg, "--undo-goto") == 0)
+         {
+           if (i+1 < argc && atoi(argv[i+1]) > 0)
+             {
+               data->clientdata = argv[i+1];
+               action = GA_UNDOGOTO;
+               ++i;
+             }
+           else
+             {
+               g_printerr ("--undo-goto requires the id of a node as listed by --undo-tree\n");
+               wrong_arg = TRUE;
+             }
+         }
        else
          {
            g_printerr ("Unknown Option to control a running Gromit-MPX process: \"%s\"\n", arg);
@@ -1234,7 +1337,8 @@ int main (int argc, char **argv)
   */
   data->display = gdk_display_get_default ();
   data->screen = gdk_display_get_default_screen (data->display);
-  data->xinerama = gdk_screen_get_n_monitors (data->screen) > 1;
+  data->monitors = monitors_new (data);
+  data->xinerama = data->monitors->len > 1;
   data->composited = gdk_screen_is_composited (data->screen);
   data->root = gdk_screen_get_root_window (data->screen);
   data->width = gdk_window_get_width (data->root);
@@ -1296,6 +1400,7 @@ int main (int argc, char **argv)
   setup_main_app (data, argc, argv);
   gtk_main ();
   shutdown_input_devices(data);
+  present_free (data);
   write_keyfile(data); // save keyfile config
   g_free (data);
   return 0;
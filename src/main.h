@@ -54,12 +54,21 @@
 #define GA_RELOAD     gdk_atom_intern ("Gromit/reload", FALSE)
 #define GA_UNDO       gdk_atom_intern ("Gromit/undo", FALSE)
 #define GA_REDO       gdk_atom_intern ("Gromit/redo", FALSE)
+#define GA_UNDOTREE   gdk_atom_intern ("Gromit/undotree", FALSE)
+#define GA_UNDOGOTO   gdk_atom_intern ("Gromit/undogoto", FALSE)
 
 #define GA_DATA       gdk_atom_intern ("Gromit/data", FALSE)
 #define GA_TOGGLEDATA gdk_atom_intern ("Gromit/toggledata", FALSE)
 #define GA_LINEDATA   gdk_atom_intern ("Gromit/linedata", FALSE)
+#define GA_UNDOGOTODATA gdk_atom_intern ("Gromit/undogotodata", FALSE)
 
 #define GROMIT_MAX_UNDO 100
+/* take a raster keyframe of the backbuffer every this many undoable ops */
+#define GROMIT_UNDO_KEYFRAME_INTERVAL 16
+/* upper bound for the nodes of the undo tree, including alternative branches */
+#define GROMIT_MAX_UNDO_NODES (4 * GROMIT_MAX_UNDO)
+/* entries of a tool's table of line widths by pressure */
+#define GROMIT_PRESSURE_LUT_SIZE 1024
 
 typedef enum
 {
@@ -70,7 +79,15 @@ typedef enum
   GROMIT_ORTHOGONAL,
   GROMIT_ERASER,
   GROMIT_RECOLOR,
-  GROMIT_CIRCLE
+  GROMIT_CIRCLE,
+  GROMIT_LASER,
+  GROMIT_HIGHLIGHT,
+  GROMIT_SPOTLIGHT,
+  GROMIT_LENS,
+  GROMIT_FILL,
+  GROMIT_LASSO,
+  GROMIT_TEXT,
+  GROMIT_STAMP
 } GromitPaintType;
 
 typedef enum
@@ -80,6 +97,13 @@ typedef enum
   GROMIT_ARROW_DOUBLE = (GROMIT_ARROW_START | GROMIT_ARROW_END )
 } GromitArrowType;
 
+/* a point of a tool's pressure curve, both in 0..1 */
+typedef struct
+{
+  gfloat pressure;
+  gfloat response;
+} GromitCurvePoint;
+
 typedef struct
 {
   GromitPaintType type;
@@ -93,18 +117,51 @@ typedef struct
   guint           maxangle;
   guint           simplify;
   guint           snapdist;
+  gfloat          stabilize;    /* One-Euro minimum cutoff in Hz, 0 is off */
+  gfloat          stabilize_beta; /* how much the cutoff rises with speed */
   GdkRGBA         *paint_color;
   GdkRGBA         *fill_color;
-  cairo_t         *paint_ctx;
+  cairo_t         *paint_ctx;    /* use paint_context_cairo() */
+  guint           generation;   /* of the backbuffer paint_ctx draws to */
   gdouble         pressure;
   gfloat          textsize;
   gboolean        showlength;
+  gfloat          fade;         /* seconds LASER strokes take to vanish */
+  gboolean        spot_rect;    /* SPOTLIGHT hole is a square, not a circle */
+  gfloat          zoom;         /* LENS magnification */
+  gfloat          recognize;    /* shape recognition tolerance in percent, 0 is off */
+  gchar           *image;       /* file a STAMP stamps */
+  guint           predict;      /* ms freehand strokes are extrapolated, 0 is off */
+  guint           predict_samples; /* the extrapolation is fitted to */
+  gfloat          gamma;        /* pressure response is pressure^gamma */
+  GArray          *curve;       /* then mapped by these GromitCurvePoints, or NULL */
+  gfloat          tilt;         /* widening of fully tilted pens, 0 is off */
+  gfloat          *pressure_lut; /* line width by pressure, see paint_context_pressure_lut() */
 } GromitPaintContext;
 
+/* a recorded, replayable drawing operation, see undo.h */
+typedef struct _GromitOp GromitOp;
+typedef struct _GromitUndoNode GromitUndoNode;
+typedef struct _GromitFade GromitFade;
+typedef struct _GromitSpotlight GromitSpotlight;
+typedef struct _GromitLens GromitLens;
+typedef struct _GromitLasso GromitLasso;
+typedef struct _GromitText GromitText;
+typedef struct _GromitPredictor GromitPredictor;
+
+/* state of a device's freehand stroke stabilizer, see stabilizer_filter() */
+typedef struct
+{
+  gdouble      x, y;       /* last filtered sample */
+  gdouble      dx, dy;     /* filtered speed in pixels per second */
+  guint32      time;
+} GromitStabilizer;
+
 typedef struct
 {
   gdouble      lastx;
   gdouble      lasty;
+  gfloat       lastwidth;
   guint32      motion_time;
   GList*       coordlist;
   GdkDevice*   device;
@@ -114,9 +171,30 @@ typedef struct
   gboolean     is_grabbed;
   gboolean     was_grabbed;
   GdkDevice*   lastslave;
+  GromitOp*    cur_op;
+  /* translucent strokes are drawn opaque here and blended once, see drawing.h */
+  cairo_surface_t *scratch;
+  cairo_t*     scratch_ctx;
+  GdkRGBA      scratch_color;
+  gdouble      scratch_alpha;
+  GdkRectangle scratch_rect;
+  GdkRectangle scratch_area;  /* the part of the window the scratch surface covers */
+  GromitSpotlight *spotlight; /* while a SPOTLIGHT button is down */
+  GromitLens*  lens;          /* while a LENS button is down, see lens.h */
+  GromitLasso* lasso;         /* a lasso or its floating selection, see lasso.h */
+  GromitText*  text;          /* while typing with a TEXT tool */
+  GromitPredictor *predict;   /* while drawing ahead of the pointer, see predict.h */
+  GromitStabilizer stabilizer;
 } GromitDeviceData;
 
 
+/* a monitor and the part of the backbuffer showing it */
+typedef struct
+{
+  GdkMonitor  *monitor;
+  GdkRectangle geometry;
+} GromitMonitor;
+
 typedef struct
 {
   GtkWidget   *win;
@@ -128,6 +206,7 @@ typedef struct
   GdkDisplay  *display;
   GdkScreen   *screen;
   gboolean     xinerama;
+  GArray      *monitors;    /* of GromitMonitor, see monitors_new() */
   gboolean     composited;
   GdkWindow   *root;
   gchar       *hot_keyval;
@@ -135,6 +214,10 @@ typedef struct
   gchar       *undo_keyval;
   guint        undo_keycode;
   gdouble      opacity;
+  guint        scale;       /* device pixels per logical pixel of the buffers */
+  guint        scale_setting; /* 0 for the monitors' scale factor */
+  gboolean     xshm;        /* present through MIT-SHM, see present.h */
+  gpointer     present_gc;
 
   GdkRGBA     *white;
   GdkRGBA     *black;
@@ -146,15 +229,39 @@ typedef struct
   GHashTable  *tool_config;
 
   cairo_surface_t *backbuffer;
+  /* bumped whenever backbuffer is replaced or its drawing settings change */
+  guint        backbuffer_generation;
   /* Auxiliary backbuffer for tools like LINE or RECT */
   cairo_surface_t *aux_backbuffer;
+  /* unused scratch surfaces for translucent strokes */
+  GSList      *scratch_pool;
+  /* pixels a FILL has visited, all zero between fills */
+  guint8      *fill_visited;
+  gsize        fill_visited_size;
+  /* dab masks of the pressure pen brush, see brush.h */
+  GHashTable  *brush_cache;
+  GQueue      *brush_lru;
+  GMutex       brush_lock;
+  /* glyph caches for labels, by text size */
+  GHashTable  *label_fonts;
+  GMutex       label_lock;
+  /* decoded and scaled STAMP images, see stamp.h */
+  GHashTable  *stamp_images;
+  GHashTable  *stamp_cache;
+  GQueue      *stamp_lru;
+  GMutex       stamp_lock;
+  /* LASER strokes fading out, of GromitFade */
+  GQueue      *fades;
+  guint        fade_tick;
+  /* workers for tiled batch redraws, see draw_ops_tiled() */
+  GThreadPool *tile_pool;
 
   GHashTable  *devdatatable;
 
   guint        timeout_id;
   guint        modified;
   guint        delayed;
-  guint        maxwidth;
+  gfloat       maxwidth;
   guint        width;
   guint        height;
   guint        client;
@@ -164,14 +271,17 @@ typedef struct
 
   gchar       *clientdata;
 
-  /* undo buffer */
-  gchar  *undo_buffer[GROMIT_MAX_UNDO];
-  size_t undo_buffer_size[GROMIT_MAX_UNDO];
-  size_t undo_buffer_used[GROMIT_MAX_UNDO];
+  /* undo history, see undo.h */
+  GHashTable     *undo_nodes;  /* by id */
+  GromitUndoNode *undo_root;
+  GromitUndoNode *undo_current;
+  GList          *undo_redo;
+  guint  undo_last_id;
+  guint  undo_visits;
+  cairo_surface_t *undo_surface;
   gchar *undo_temp;
   size_t undo_temp_size;
   size_t undo_temp_used;
-  gint   undo_head, undo_depth, redo_depth;
 
   gboolean show_intro_on_startup;
 
@@ -187,12 +297,6 @@ void parse_print_help (gpointer key, gpointer value, gpointer user_data);
 void select_tool (GromitData *data, GdkDevice *device, GdkDevice *slave_device, guint state);
 
 void copy_surface (cairo_surface_t *dst, cairo_surface_t *src);
-void snap_undo_state(GromitData *data);
-void undo_drawing (GromitData *data);
-void redo_drawing (GromitData *data);
-void undo_compress(GromitData *data, cairo_surface_t *surface);
-void undo_temp_buffer_to_slot(GromitData *data, gint undo_slot);
-void undo_decompress(GromitData *data, gint undo_slot, cairo_surface_t *surface);
 
 void clear_screen (GromitData *data);
 
@@ -202,6 +306,17 @@ GromitPaintContext *paint_context_new (GromitData *data, GromitPaintType type,
                                        guint simplify, guint radius, guint maxangle, guint minlen, guint snapdist,
                                        guint minwidth, guint maxwidth);
 void paint_context_free (GromitPaintContext *context);
+void paint_context_pressure_lut (GromitPaintContext *context);
+cairo_t *paint_context_cairo (GromitData *data, GromitPaintContext *context);
+GArray *monitors_new (GromitData *data);
+
+/* highest internal scale, the buffers grow quadratically with it */
+#define GROMIT_MAX_SCALE 4
+
+guint canvas_scale (GromitData *data);
+cairo_surface_t *canvas_surface_new (GromitData *data);
+void canvas_rescale (GromitData *data);
+cairo_operator_t paint_operator (GromitPaintType type);
 
 void indicate_active(GromitData *data, gboolean YESNO);
 
@@ -0,0 +1,251 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <math.h>
+#include "predict.h"
+
+typedef struct
+{
+  gdouble x, y;
+  guint32 time;
+} GromitPredictSample;
+
+struct _GromitPredictor
+{
+  GromitData         *data;       /* for the timeout */
+  GromitPredictSample samples[GROMIT_PREDICT_MAX_SAMPLES];
+  guint               n;          /* valid samples, the newest at head */
+  guint               head;
+  gfloat              width;      /* of the newest sample */
+  gboolean            shown;
+  gdouble             x0, y0;     /* the shown segment */
+  gdouble             x1, y1;
+  GdkRectangle        area;       /* covers the shown segment */
+  guint               timeout;
+};
+
+
+static void predict_hide (GromitData *data, GromitPredictor *pred)
+{
+  if (pred->shown)
+    gdk_window_invalidate_rect (gtk_widget_get_window (data->win), &pred->area, 0);
+  pred->shown = FALSE;
+}
+
+
+static gboolean predict_timeout (gpointer user_data)
+{
+  GromitPredictor *pred = user_data;
+
+  /* the pointer rests, there is nothing to predict */
+  pred->timeout = 0;
+  predict_hide (pred->data, pred);
+
+  return G_SOURCE_REMOVE;
+}
+
+
+/*
+ * records a sample of the device's stroke, from the button press on
+ */
+void predict_add (GromitData *data, GromitDeviceData *devdata,
+                  gdouble x, gdouble y, gfloat width, guint32 time)
+{
+  GromitPaintContext *context = devdata->cur_context;
+  GromitPredictor *pred = devdata->predict;
+
+  /* the window shape could not keep up with it, see predict.h */
+  if (!context || context->predict == 0 || !data->composited)
+    return;
+
+  /* shapes are redrawn on each motion anyway, erasing has no ink */
+  if (context->type == GROMIT_LINE || context->type == GROMIT_RECT ||
+      context->type == GROMIT_CIRCLE || context->type == GROMIT_ERASER ||
+      context->type == GROMIT_RECOLOR)
+    return;
+
+  if (!pred)
+    pred = devdata->predict = g_new0 (GromitPredictor, 1);
+  pred->data = data;
+
+  /* several samples of one timestamp do not tell the speed */
+  if (pred->n > 0 && pred->samples[pred->head].time == time)
+    pred->n--;
+  else
+    pred->head = (pred->head + 1) % GROMIT_PREDICT_MAX_SAMPLES;
+
+  pred->samples[pred->head].x = x;
+  pred->samples[pred->head].y = y;
+  pred->samples[pred->head].time = time;
+  pred->n = MIN (pred->n + 1, GROMIT_PREDICT_MAX_SAMPLES);
+  pred->width = width;
+}
+
+
+/*
+ * replaces the device's predicted segment by one from its newest samples,
+ * to be called once the ink up to them is drawn
+ */
+void predict_update (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitPaintContext *context = devdata->cur_context;
+  GromitPredictor *pred = devdata->predict;
+  GdkWindow *window = gtk_widget_get_window (data->win);
+  gdouble st = 0, sx = 0, sy = 0, stt = 0, stx = 0, sty = 0;
+  guint i, n;
+
+  if (!pred)
+    return;
+
+  predict_hide (data, pred);
+
+  n = MIN (pred->n, CLAMP (context->predict_samples, 2, GROMIT_PREDICT_MAX_SAMPLES));
+  if (n < 2)
+    return;
+
+  /* least squares fit of x(t) and y(t), t relative to the newest sample */
+  GromitPredictSample *last = &pred->samples[pred->head];
+  for (i = 0; i < n; ++i)
+    {
+      GromitPredictSample *s = &pred->samples[(pred->head + GROMIT_PREDICT_MAX_SAMPLES - i)
+                                              % GROMIT_PREDICT_MAX_SAMPLES];
+      gdouble t = -(gdouble) (guint32) (last->time - s->time);
+      st += t;
+      sx += s->x;
+      sy += s->y;
+      stt += t * t;
+      stx += t * s->x;
+      sty += t * s->y;
+    }
+
+  gdouble det = n * stt - st * st;
+  if (det <= 0)
+    return;
+
+  /* continue from where the ink ends, at the fitted speed */
+  gdouble dx = (n * stx - st * sx) / det * context->predict;
+  gdouble dy = (n * sty - st * sy) / det * context->predict;
+  gdouble len = sqrt (dx * dx + dy * dy);
+  if (len < 1)
+    return;
+  if (len > GROMIT_PREDICT_MAX_LENGTH)
+    {
+      dx *= GROMIT_PREDICT_MAX_LENGTH / len;
+      dy *= GROMIT_PREDICT_MAX_LENGTH / len;
+    }
+
+  pred->x0 = last->x;
+  pred->y0 = last->y;
+  pred->x1 = last->x + dx;
+  pred->y1 = last->y + dy;
+
+  gdouble r = MAX (pred->width / 2.0, 0.5);
+  pred->area.x = floor (MIN (pred->x0, pred->x1) - r) - 1;
+  pred->area.y = floor (MIN (pred->y0, pred->y1) - r) - 1;
+  pred->area.width = ceil (MAX (pred->x0, pred->x1) + r) + 1 - pred->area.x;
+  pred->area.height = ceil (MAX (pred->y0, pred->y1) + r) + 1 - pred->area.y;
+  pred->shown = TRUE;
+  gdk_window_invalidate_rect (window, &pred->area, 0);
+
+  /* motion events stop when the pointer does, the guess must not linger */
+  if (pred->timeout)
+    g_source_remove (pred->timeout);
+  pred->timeout = g_timeout_add (MAX (2 * context->predict, 20), predict_timeout, pred);
+}
+
+
+void predict_end (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitPredictor *pred = devdata->predict;
+
+  if (!pred)
+    return;
+
+  predict_hide (data, pred);
+  if (pred->timeout)
+    g_source_remove (pred->timeout);
+  g_free (pred);
+  devdata->predict = NULL;
+}
+
+
+/*
+ * the area the device's predicted segment covers, FALSE if none is shown
+ */
+gboolean predict_area (GromitDeviceData *devdata, GdkRectangle *rect)
+{
+  GromitPredictor *pred = devdata->predict;
+
+  if (!pred || !pred->shown)
+    return FALSE;
+
+  *rect = pred->area;
+  return TRUE;
+}
+
+
+/*
+ * strokes the device's predicted segment with the source and operator
+ * set on cr
+ */
+void predict_stroke (GromitDeviceData *devdata, cairo_t *cr)
+{
+  GromitPredictor *pred = devdata->predict;
+
+  if (!pred || !pred->shown)
+    return;
+
+  cairo_save (cr);
+  cairo_set_line_width (cr, MAX (pred->width, 1));
+  cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
+  cairo_move_to (cr, pred->x0, pred->y0);
+  cairo_line_to (cr, pred->x1, pred->y1);
+  cairo_stroke (cr);
+  cairo_restore (cr);
+}
+
+
+/*
+ * draws the predicted segments of all devices whose ink goes straight
+ * to the backbuffer, scratch_expose() blends the others with their stroke
+ */
+void predict_expose (GromitData *data, cairo_t *cr)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitDeviceData *devdata = value;
+      GromitPredictor *pred = devdata->predict;
+      if (!pred || !pred->shown || !devdata->cur_context || devdata->scratch_ctx)
+        continue;
+
+      cairo_save (cr);
+      gdk_cairo_set_source_rgba (cr, devdata->cur_context->paint_color);
+      cairo_set_operator (cr, paint_operator (devdata->cur_context->type));
+      predict_stroke (devdata, cr);
+      cairo_restore (cr);
+    }
+}
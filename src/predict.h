@@ -0,0 +1,58 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef PREDICT_H
+#define PREDICT_H
+
+/*
+  Motion prediction for freehand strokes.
+
+  Ink can only be drawn up to the last pointer sample, so it trails the
+  pen by the latency of the input and drawing pipeline. With a tool's
+  predict option set, a straight line is fitted to the device's most
+  recent timestamped samples and the stroke is extrapolated by that many
+  milliseconds into a transient overlay. The overlay never touches the
+  backbuffer, each new sample replaces it with real ink and a new guess,
+  and it vanishes when the pointer pauses or the button is released.
+  Translucent strokes blend it with their scratch surface as one, so it
+  looks like the ink it stands in for. Without compositing there is no
+  prediction: the window shape is only updated every few frames and
+  would hide most guesses.
+*/
+
+#include "main.h"
+
+/* upper bound of a tool's predictsamples option */
+#define GROMIT_PREDICT_MAX_SAMPLES 16
+/* predicted segments longer than this are cut short, in pixels */
+#define GROMIT_PREDICT_MAX_LENGTH 64
+
+void predict_add (GromitData *data, GromitDeviceData *devdata,
+                  gdouble x, gdouble y, gfloat width, guint32 time);
+void predict_update (GromitData *data, GromitDeviceData *devdata);
+void predict_end (GromitData *data, GromitDeviceData *devdata);
+void predict_expose (GromitData *data, cairo_t *cr);
+gboolean predict_area (GromitDeviceData *devdata, GdkRectangle *rect);
+void predict_stroke (GromitDeviceData *devdata, cairo_t *cr);
+
+#endif
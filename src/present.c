@@ -0,0 +1,243 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "present.h"
+
+#ifdef HAVE_XSHM
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <gdk/gdkx.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+
+typedef struct
+{
+  Display         *dpy;
+  XImage          *image;
+  XShmSegmentInfo  info;
+} GromitShmBuffer;
+
+static cairo_user_data_key_t shm_key;
+
+
+static void shm_buffer_free (gpointer ptr)
+{
+  GromitShmBuffer *buf = ptr;
+
+  /* the server may still be reading from it */
+  XShmDetach (buf->dpy, &buf->info);
+  XSync (buf->dpy, False);
+
+  buf->image->data = NULL;
+  XDestroyImage (buf->image);
+  shmdt (buf->info.shmaddr);
+  g_free (buf);
+}
+
+
+/*
+ * an image surface whose pixels are an XShm segment, or NULL
+ */
+static cairo_surface_t *shm_surface_new (GromitData *data, guint width, guint height)
+{
+  Display *dpy = GDK_DISPLAY_XDISPLAY (data->display);
+  /* XShmPutImage() needs the window's depth, cairo's ARGB32 needs 32 */
+  GdkVisual *visual = gtk_widget_get_visual (data->win);
+  GromitShmBuffer *buf;
+  cairo_surface_t *surface;
+
+  if (!XShmQueryExtension (dpy) || gdk_visual_get_depth (visual) != 32)
+    return NULL;
+
+  buf = g_new0 (GromitShmBuffer, 1);
+  buf->dpy = dpy;
+  buf->image = XShmCreateImage (dpy, GDK_VISUAL_XVISUAL (visual), gdk_visual_get_depth (visual),
+                                ZPixmap, NULL, &buf->info, width, height);
+
+  /* cairo's ARGB32 is native endian 32 bit, so must be the image */
+  if (!buf->image || buf->image->bits_per_pixel != 32 ||
+      buf->image->byte_order != (G_BYTE_ORDER == G_LITTLE_ENDIAN ? LSBFirst : MSBFirst))
+    goto fail;
+
+  buf->info.shmid = shmget (IPC_PRIVATE, buf->image->bytes_per_line * height, IPC_CREAT | 0600);
+  if (buf->info.shmid < 0)
+    goto fail;
+
+  buf->info.shmaddr = buf->image->data = shmat (buf->info.shmid, NULL, 0);
+  buf->info.readOnly = True;
+
+  if (buf->info.shmaddr == (char *) -1 || !XShmAttach (dpy, &buf->info))
+    {
+      shmctl (buf->info.shmid, IPC_RMID, NULL);
+      goto fail;
+    }
+  XSync (dpy, False);
+
+  /* goes away once both sides have detached */
+  shmctl (buf->info.shmid, IPC_RMID, NULL);
+
+  surface = cairo_image_surface_create_for_data ((unsigned char *) buf->image->data,
+                                                 CAIRO_FORMAT_ARGB32, width, height,
+                                                 buf->image->bytes_per_line);
+  cairo_surface_set_user_data (surface, &shm_key, buf, shm_buffer_free);
+  cairo_surface_set_device_scale (surface, data->scale, data->scale);
+
+  if(data->debug)
+    g_printerr("DEBUG: Backbuffer of %ux%u in XShm segment %d.\n", width, height, buf->info.shmid);
+
+  return surface;
+
+ fail:
+  if (buf->image)
+    {
+      buf->image->data = NULL;
+      XDestroyImage (buf->image);
+    }
+  g_free (buf);
+  return NULL;
+}
+
+#endif
+
+
+/*
+ * creates a backbuffer of the given logical size at data->scale, in shared
+ * memory if the presenter is enabled
+ */
+cairo_surface_t *present_surface_new (GromitData *data, guint width, guint height)
+{
+  cairo_surface_t *surface;
+
+#ifdef HAVE_XSHM
+  if (data->xshm && GDK_IS_X11_DISPLAY (data->display))
+    {
+      surface = shm_surface_new (data, width * data->scale, height * data->scale);
+      if (surface)
+        return surface;
+
+      g_printerr ("Could not set up an XShm backbuffer, presenting through GTK.\n");
+      data->xshm = FALSE;
+    }
+#endif
+  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width * data->scale, height * data->scale);
+  cairo_surface_set_device_scale (surface, data->scale, data->scale);
+  return surface;
+}
+
+
+/*
+ * Moves the backbuffer into shared memory if the presenter got enabled and
+ * turns GTK's double buffering off while presenting ourselves. Call after
+ * changes to data->xshm or data->composited.
+ */
+void present_update (GromitData *data)
+{
+#ifdef HAVE_XSHM
+  if (data->xshm && !cairo_surface_get_user_data (data->backbuffer, &shm_key))
+    {
+      cairo_surface_t *surface = present_surface_new (data, data->width, data->height);
+      if (data->xshm)
+        {
+          cairo_t *cr = cairo_create (surface);
+          cairo_set_source_surface (cr, data->backbuffer, 0, 0);
+          cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+          cairo_paint (cr);
+          cairo_destroy (cr);
+
+          cairo_surface_destroy (data->backbuffer);
+          data->backbuffer = surface;
+          data->backbuffer_generation++;
+        }
+      else
+        cairo_surface_destroy (surface);
+    }
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  gtk_widget_set_double_buffered (data->win, !(data->xshm && !data->composited));
+  G_GNUC_END_IGNORE_DEPRECATIONS
+#endif
+}
+
+
+/*
+ * Puts the exposed part of the backbuffer onto the window if the presenter
+ * is active. Returns FALSE if the expose should be drawn as usual.
+ */
+gboolean present_expose (GromitData *data, cairo_t *cr)
+{
+#ifdef HAVE_XSHM
+  GromitShmBuffer *buf;
+  GdkWindow *window = gtk_widget_get_window (data->win);
+  GdkRectangle rect;
+
+  /* the image has to match the window's pixels one to one */
+  if (!data->xshm || data->composited || !window ||
+      (guint) gdk_window_get_scale_factor (window) != data->scale)
+    return FALSE;
+
+  buf = cairo_surface_get_user_data (data->backbuffer, &shm_key);
+  if (!buf)
+    return FALSE;
+
+  GdkRectangle area = { 0, 0, data->width, data->height };
+  if (!gdk_cairo_get_clip_rectangle (cr, &rect) ||
+      !gdk_rectangle_intersect (&rect, &area, &rect))
+    return TRUE;
+
+  if (!data->present_gc)
+    data->present_gc = XCreateGC (buf->dpy, GDK_WINDOW_XID (window), 0, NULL);
+
+  rect.x *= data->scale;
+  rect.y *= data->scale;
+  rect.width *= data->scale;
+  rect.height *= data->scale;
+
+  cairo_surface_flush (data->backbuffer);
+
+  /* a later change racing with this read is followed by its own expose */
+  XShmPutImage (buf->dpy, GDK_WINDOW_XID (window), (GC) data->present_gc, buf->image,
+                rect.x, rect.y, rect.x, rect.y, rect.width, rect.height, False);
+  XFlush (buf->dpy);
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+
+/*
+ * frees what the presenter holds on the X server, call when the window's
+ * screen or visual changes and on shutdown
+ */
+void present_free (GromitData *data)
+{
+#ifdef HAVE_XSHM
+  if (data->present_gc)
+    {
+      XFreeGC (GDK_DISPLAY_XDISPLAY (data->display), (GC) data->present_gc);
+      data->present_gc = NULL;
+    }
+#endif
+}
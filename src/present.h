@@ -0,0 +1,43 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef PRESENT_H
+#define PRESENT_H
+
+/*
+  Optional MIT-SHM presenter for non-composited X11.
+
+  When enabled, the backbuffer lives in a shared memory segment that is
+  also an XImage, and exposes are answered by XShmPutImage() of just the
+  damaged rectangle, straight into the window. GTK's double buffer and
+  the extra copy through it are bypassed.
+*/
+
+#include "main.h"
+
+cairo_surface_t *present_surface_new (GromitData *data, guint width, guint height);
+void present_update (GromitData *data);
+gboolean present_expose (GromitData *data, cairo_t *cr);
+void present_free (GromitData *data);
+
+#endif
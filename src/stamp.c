@@ -0,0 +1,232 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <math.h>
+
+#include "stamp.h"
+#include "drawing.h"
+#include "undo.h"
+
+typedef struct
+{
+  cairo_surface_t *surface;
+  GList           *link;     /* in data->stamp_lru */
+} GromitStampVariant;
+
+
+static void stamp_variant_free (gpointer ptr)
+{
+  GromitStampVariant *variant = ptr;
+  cairo_surface_destroy (variant->surface);
+  g_free (variant);
+}
+
+
+static void stamp_image_free (gpointer ptr)
+{
+  if (ptr)
+    cairo_surface_destroy (ptr);
+}
+
+
+/*
+ * the decoded image, NULL if it cannot be loaded; only tried once
+ */
+static cairo_surface_t *stamp_image_get (GromitData *data, const gchar *image)
+{
+  cairo_surface_t *surface = NULL;
+  gpointer value;
+  GError *error = NULL;
+
+  if (!data->stamp_images)
+    data->stamp_images = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, stamp_image_free);
+
+  if (g_hash_table_lookup_extended (data->stamp_images, image, NULL, &value))
+    return value;
+
+  GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file (image, &error);
+  if (pixbuf)
+    {
+      /* premultiplied, as cairo blends it */
+      surface = gdk_cairo_surface_create_from_pixbuf (pixbuf, 1, NULL);
+      g_object_unref (pixbuf);
+
+      if(data->debug)
+        g_printerr("DEBUG: Loaded stamp image %s of %dx%d.\n", image,
+                   cairo_image_surface_get_width (surface),
+                   cairo_image_surface_get_height (surface));
+    }
+  else
+    {
+      g_printerr ("WARNING: Unable to load stamp image %s: %s\n", image, error->message);
+      g_error_free (error);
+    }
+
+  g_hash_table_insert (data->stamp_images, g_strdup (image), surface);
+  return surface;
+}
+
+
+/*
+ * The image scaled by zoom at the resolution of the backbuffer, from the
+ * cache, rendering and possibly evicting as needed.
+ */
+static GromitStampVariant *stamp_variant_get (GromitData *data, const gchar *image, gfloat zoom)
+{
+  gchar *key = g_strdup_printf ("%u:%u:%s", (guint) (zoom * 16 + 0.5), data->scale, image);
+  GromitStampVariant *variant;
+
+  if (!data->stamp_cache)
+    {
+      data->stamp_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 NULL, stamp_variant_free);
+      data->stamp_lru = g_queue_new ();
+    }
+
+  variant = g_hash_table_lookup (data->stamp_cache, key);
+  if (variant)
+    {
+      /* most recently used first */
+      g_queue_unlink (data->stamp_lru, variant->link);
+      g_queue_push_head_link (data->stamp_lru, variant->link);
+      g_free (key);
+      return variant;
+    }
+
+  cairo_surface_t *source = stamp_image_get (data, image);
+  if (!source)
+    {
+      g_free (key);
+      return NULL;
+    }
+
+  if (g_queue_get_length (data->stamp_lru) >= GROMIT_STAMP_CACHE_SIZE)
+    {
+      gchar *old = g_queue_pop_tail (data->stamp_lru);
+      g_hash_table_remove (data->stamp_cache, old);
+      g_free (old);
+    }
+
+  gdouble factor = zoom * data->scale;
+  gint width = MAX (ceil (cairo_image_surface_get_width (source) * factor), 1);
+  gint height = MAX (ceil (cairo_image_surface_get_height (source) * factor), 1);
+
+  variant = g_new0 (GromitStampVariant, 1);
+  variant->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_t *cr = cairo_create (variant->surface);
+  cairo_scale (cr, factor, factor);
+  cairo_set_source_surface (cr, source, 0, 0);
+  cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_GOOD);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+  cairo_surface_set_device_scale (variant->surface, data->scale, data->scale);
+
+  g_queue_push_head (data->stamp_lru, key);
+  variant->link = g_queue_peek_head_link (data->stamp_lru);
+  g_hash_table_insert (data->stamp_cache, key, variant);
+
+  return variant;
+}
+
+
+/*
+ * decodes the image ahead of its first use, FALSE if it cannot be loaded
+ */
+gboolean stamp_load (GromitData *data, const gchar *image)
+{
+  g_mutex_lock (&data->stamp_lock);
+  gboolean ok = stamp_image_get (data, image) != NULL;
+  g_mutex_unlock (&data->stamp_lock);
+  return ok;
+}
+
+
+/*
+ * Draws the image scaled by zoom, centered at (x,y). Safe to call from
+ * tile workers.
+ */
+void stamp_paint (GromitData *data, cairo_t *cr, const gchar *image,
+                  gint x, gint y, gfloat zoom, GdkRectangle *rect)
+{
+  rect->width = rect->height = 0;
+
+  /* tile workers share the cache, keep the surface even if it gets evicted */
+  g_mutex_lock (&data->stamp_lock);
+  GromitStampVariant *variant = stamp_variant_get (data, image, zoom);
+  cairo_surface_t *surface = variant ? cairo_surface_reference (variant->surface) : NULL;
+  g_mutex_unlock (&data->stamp_lock);
+
+  if (!surface)
+    return;
+
+  rect->width = (cairo_image_surface_get_width (surface) + data->scale - 1) / data->scale;
+  rect->height = (cairo_image_surface_get_height (surface) + data->scale - 1) / data->scale;
+  rect->x = x - rect->width / 2;
+  rect->y = y - rect->height / 2;
+
+  /* integer offsets keep this on pixman's fast unscaled path */
+  cairo_save (cr);
+  cairo_set_source_surface (cr, surface, rect->x, rect->y);
+  cairo_paint (cr);
+  cairo_restore (cr);
+
+  cairo_surface_destroy (surface);
+}
+
+
+/*
+ * stamps the tool's image centered at (x,y)
+ */
+void draw_stamp (GromitData *data, GdkDevice *dev, gint x, gint y)
+{
+  GromitDeviceData *devdata = g_hash_table_lookup(data->devdatatable, dev);
+  GromitPaintContext *context = devdata->cur_context;
+  GdkRectangle rect;
+
+  if (!context->image)
+    return;
+
+  GromitOp *op = undo_op_new (GROMIT_OP_STROKE, context);
+  op->device = devdata->device;
+  op->has_fill = FALSE;
+  op->image = g_strdup (context->image);
+
+  cairo_t *cr = cairo_create (data->backbuffer);
+  stamp_paint (data, cr, op->image, x, y, context->zoom, &rect);
+  cairo_destroy (cr);
+
+  if (rect.width == 0)
+    {
+      undo_op_unref (op);
+      return;
+    }
+
+  undo_op_add_prim (op, GROMIT_PRIM_STAMP, x, y, context->zoom, 0, &rect);
+
+  gdk_window_invalidate_rect(gtk_widget_get_window(data->win), &rect, 0);
+  data->modified = 1;
+  data->painted = 1;
+
+  undo_commit (data, op);
+}
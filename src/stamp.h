@@ -0,0 +1,46 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef STAMP_H
+#define STAMP_H
+
+/*
+  Image stamps of the STAMP tool.
+
+  Each image file is decoded once into a premultiplied ARGB32 surface,
+  when the tool is configured or first used. Copies scaled to the tool's
+  zoom and the backbuffer's resolution are kept in a small LRU cache, so
+  stamping is a blit of a ready surface at an integer offset.
+*/
+
+#include "main.h"
+
+/* number of scaled stamp images kept around */
+#define GROMIT_STAMP_CACHE_SIZE 32
+
+gboolean stamp_load (GromitData *data, const gchar *image);
+void stamp_paint (GromitData *data, cairo_t *cr, const gchar *image,
+                  gint x, gint y, gfloat zoom, GdkRectangle *rect);
+void draw_stamp (GromitData *data, GdkDevice *dev, gint x, gint y);
+
+#endif
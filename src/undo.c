@@ -0,0 +1,852 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <lz4.h>
+
+#include "undo.h"
+#include "drawing.h"
+#include "lasso.h"
+
+struct _GromitKeyframe
+{
+  gchar *buffer;
+  size_t used;
+};
+
+/* where undo left off, so redo can return there */
+typedef struct
+{
+  GdkDevice      *device;
+  GromitOp       *op;
+  GromitUndoNode *before;
+  GromitUndoNode *after;
+} GromitRedo;
+
+
+GromitOp *undo_op_new (GromitOpType type, GromitPaintContext *context)
+{
+  GromitOp *op = g_new0 (GromitOp, 1);
+
+  op->ref_count = 1;
+  op->type = type;
+  op->prims = g_array_new (FALSE, FALSE, sizeof (GromitPrim));
+
+  if (context)
+    {
+      op->paint_type = context->type;
+      op->color = *context->paint_color;
+      if (context->fill_color)
+        {
+          op->fill_color = *context->fill_color;
+          op->has_fill = TRUE;
+        }
+    }
+
+  return op;
+}
+
+
+GromitOp *undo_op_ref (GromitOp *op)
+{
+  op->ref_count++;
+  return op;
+}
+
+
+void undo_op_unref (GromitOp *op)
+{
+  if (!op || --op->ref_count > 0)
+    return;
+  g_array_free (op->prims, TRUE);
+  g_free (op->label);
+  if (op->mask)
+    cairo_surface_destroy (op->mask);
+  if (op->layer)
+    cairo_surface_destroy (op->layer);
+  if (op->rim)
+    cairo_surface_destroy (op->rim);
+  g_free (op->image);
+  g_free (op);
+}
+
+
+/*
+ * forget what was recorded so far, used by tools that repaint
+ * their whole shape on each motion event
+ */
+void undo_op_reset (GromitOp *op)
+{
+  g_array_set_size (op->prims, 0);
+  g_free (op->label);
+  op->label = NULL;
+  if (op->mask)
+    cairo_surface_destroy (op->mask);
+  op->mask = NULL;
+  if (op->layer)
+    cairo_surface_destroy (op->layer);
+  op->layer = NULL;
+  if (op->rim)
+    cairo_surface_destroy (op->rim);
+  op->rim = NULL;
+  g_free (op->image);
+  op->image = NULL;
+  op->has_bbox = FALSE;
+}
+
+
+void undo_op_add_prim (GromitOp *op,
+                       GromitPrimType type,
+                       gfloat x, gfloat y,
+                       gfloat w, gfloat a,
+                       GdkRectangle *rect)
+{
+  GromitPrim prim = { x, y, w, a, type };
+  g_array_append_val (op->prims, prim);
+
+  if (rect)
+    {
+      if (op->has_bbox)
+        gdk_rectangle_union (&op->bbox, rect, &op->bbox);
+      else
+        op->bbox = *rect;
+      op->has_bbox = TRUE;
+    }
+}
+
+
+void undo_op_add_line (GromitOp *op,
+                       gfloat x1, gfloat y1,
+                       gfloat x2, gfloat y2,
+                       gfloat width,
+                       GdkRectangle *rect)
+{
+  GromitPrim *last = NULL;
+
+  if (op->prims->len > 0)
+    last = &g_array_index (op->prims, GromitPrim, op->prims->len - 1);
+
+  /* consecutive segments of a stroke share their end points */
+  if (!last ||
+      (last->type != GROMIT_PRIM_MOVE && last->type != GROMIT_PRIM_LINE) ||
+      last->x != x1 || last->y != y1)
+    undo_op_add_prim (op, GROMIT_PRIM_MOVE, x1, y1, width, 0, NULL);
+
+  undo_op_add_prim (op, GROMIT_PRIM_LINE, x2, y2, width, 0, rect);
+}
+
+
+void undo_op_set_label (GromitOp *op, const gchar *label)
+{
+  g_free (op->label);
+  op->label = g_strdup (label);
+}
+
+
+
+/*
+ * compress image data and store it in undo_temp
+ *
+ * undo_temp is successively grown in case it is too small
+ */
+static void undo_compress (GromitData *data, cairo_surface_t *surface)
+{
+  cairo_surface_flush (surface);
+
+  char *raw_data = (char *)cairo_image_surface_get_data(surface);
+  guint bytes_per_row = cairo_image_surface_get_stride(surface);
+  guint rows = cairo_image_surface_get_height(surface);
+  size_t src_bytes = rows * bytes_per_row;
+
+  size_t dest_bytes;
+  for (;;)
+    {
+      dest_bytes = LZ4_compress_default(raw_data, data->undo_temp, src_bytes, data->undo_temp_size);
+      if (dest_bytes == 0)
+        {
+          data->undo_temp_size *= 2;
+          data->undo_temp = g_realloc(data->undo_temp, data->undo_temp_size);
+        }
+      else
+        {
+          data->undo_temp_used = dest_bytes;
+          break;
+        }
+    }
+}
+
+
+/*
+ * decompress keyframe data and store it in cairo surface
+ */
+static void undo_decompress (GromitKeyframe *keyframe, cairo_surface_t *surface)
+{
+  cairo_surface_flush (surface);
+
+  char *dest_data = (char *)cairo_image_surface_get_data(surface);
+  guint bytes_per_row = cairo_image_surface_get_stride(surface);
+  guint rows = cairo_image_surface_get_height(surface);
+  size_t dest_bytes = rows * bytes_per_row;
+
+  if (LZ4_decompress_safe(keyframe->buffer, dest_data, keyframe->used, dest_bytes) < 0) {
+    g_printerr("Fatal error occurred decompressing image data\n");
+    exit(1);
+  }
+
+  cairo_surface_mark_dirty (surface);
+}
+
+
+static void undo_keyframe_free (GromitKeyframe *keyframe)
+{
+  if (!keyframe)
+    return;
+  g_free (keyframe->buffer);
+  g_free (keyframe);
+}
+
+
+static void undo_snap_keyframe (GromitData *data, GromitUndoNode *node,
+                                cairo_surface_t *surface)
+{
+  GromitKeyframe *keyframe = g_new (GromitKeyframe, 1);
+
+  undo_compress (data, surface);
+
+  keyframe->used = data->undo_temp_used;
+  keyframe->buffer = g_malloc (keyframe->used);
+  memcpy (keyframe->buffer, data->undo_temp, keyframe->used);
+
+  undo_keyframe_free (node->keyframe);
+  node->keyframe = keyframe;
+
+  if(data->debug)
+    g_printerr ("DEBUG: Snapped undo keyframe at node %u (%zu bytes).\n",
+                node->id, keyframe->used);
+}
+
+
+/*
+ * the backbuffer only matches the history while nobody is in the middle of a stroke
+ */
+static gboolean undo_strokes_in_progress (GromitData *data)
+{
+  GHashTableIter it;
+  gpointer value;
+
+  if (!data->devdatatable)
+    return FALSE;
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitDeviceData *devdata = value;
+      if (devdata->cur_op && devdata->cur_op->prims->len > 0)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+
+static GromitUndoNode *undo_node_new (GromitData *data, GromitUndoNode *parent, GromitOp *op)
+{
+  GromitUndoNode *node = g_new0 (GromitUndoNode, 1);
+
+  node->id = ++data->undo_last_id;
+  node->parent = parent;
+  node->op = op;
+  if (parent)
+    {
+      node->depth = parent->depth + 1;
+      parent->children = g_list_prepend (parent->children, node);
+    }
+
+  g_hash_table_insert (data->undo_nodes, GUINT_TO_POINTER (node->id), node);
+
+  return node;
+}
+
+
+/*
+ * the child of parent that applies op, creating it if there is none yet
+ */
+static GromitUndoNode *undo_node_child (GromitData *data, GromitUndoNode *parent, GromitOp *op)
+{
+  GList *ptr;
+
+  for (ptr = parent->children; ptr; ptr = ptr->next)
+    {
+      GromitUndoNode *child = ptr->data;
+      if (child->op == op)
+        return child;
+    }
+
+  return undo_node_new (data, parent, undo_op_ref (op));
+}
+
+
+/*
+ * free node and its subtree, it must have been detached from its parent
+ */
+static void undo_node_free (GromitData *data, GromitUndoNode *node)
+{
+  GList *ptr;
+
+  for (ptr = node->children; ptr; ptr = ptr->next)
+    undo_node_free (data, ptr->data);
+  g_list_free (node->children);
+
+  /* redo entries leading to or from this node are gone as well */
+  ptr = data->undo_redo;
+  while (ptr)
+    {
+      GList *next = ptr->next;
+      GromitRedo *redo = ptr->data;
+      if (redo->before == node || redo->after == node)
+        {
+          undo_op_unref (redo->op);
+          g_free (redo);
+          data->undo_redo = g_list_delete_link (data->undo_redo, ptr);
+        }
+      ptr = next;
+    }
+
+  g_hash_table_remove (data->undo_nodes, GUINT_TO_POINTER (node->id));
+  undo_op_unref (node->op);
+  undo_keyframe_free (node->keyframe);
+  g_free (node);
+}
+
+
+static void undo_node_detach (GromitUndoNode *node)
+{
+  if (node->parent)
+    node->parent->children = g_list_remove (node->parent->children, node);
+  node->parent = NULL;
+}
+
+
+static GromitUndoNode *undo_oldest_leaf (GromitData *data, GromitUndoNode *node)
+{
+  GromitUndoNode *oldest = NULL;
+  GList *ptr;
+
+  if (!node->children)
+    return node == data->undo_current ? NULL : node;
+
+  for (ptr = node->children; ptr; ptr = ptr->next)
+    {
+      GromitUndoNode *leaf = undo_oldest_leaf (data, ptr->data);
+      if (leaf && (!oldest || leaf->visited < oldest->visited))
+        oldest = leaf;
+    }
+  return oldest;
+}
+
+
+/*
+ * Keep GROMIT_MAX_UNDO steps above the current node and at most
+ * GROMIT_MAX_UNDO_NODES nodes overall, dropping the branches that
+ * were visited least recently.
+ */
+static void undo_prune (GromitData *data)
+{
+  GromitUndoNode *node;
+
+  if (data->undo_current->depth - data->undo_root->depth > GROMIT_MAX_UNDO)
+    {
+      for (node = data->undo_current; node; node = node->parent)
+        if (node->keyframe && data->undo_current->depth - node->depth >= GROMIT_MAX_UNDO)
+          break;
+
+      if (node && node != data->undo_root)
+        {
+          undo_node_detach (node);
+          undo_node_free (data, data->undo_root);
+          undo_op_unref (node->op);
+          node->op = NULL;
+          data->undo_root = node;
+        }
+    }
+
+  while (g_hash_table_size (data->undo_nodes) > GROMIT_MAX_UNDO_NODES &&
+         (node = undo_oldest_leaf (data, data->undo_root)))
+    {
+      undo_node_detach (node);
+      undo_node_free (data, node);
+    }
+}
+
+
+static void undo_copy_region (cairo_surface_t *dst, cairo_surface_t *src, GdkRectangle *rect)
+{
+  cairo_t *cr = cairo_create (dst);
+  gdk_cairo_rectangle (cr, rect);
+  cairo_clip (cr);
+  cairo_set_source_surface (cr, src, 0, 0);
+  cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  cairo_paint (cr);
+  cairo_destroy (cr);
+}
+
+
+/*
+ * Rebuild the given region of the committed state at the current node in
+ * data->undo_surface, from the nearest keyframe and the ops after it.
+ * Returns the number of replayed ops.
+ */
+static guint undo_rebuild (GromitData *data, GdkRectangle *rect, GromitUndoNode **keyframe_node)
+{
+  GPtrArray *path = g_ptr_array_new ();
+  GromitUndoNode *node;
+  guint i, n;
+
+  for (node = data->undo_current; !node->keyframe; node = node->parent)
+    g_ptr_array_add (path, node);
+
+  if (!data->undo_surface)
+    data->undo_surface = canvas_surface_new (data);
+
+  undo_decompress (node->keyframe, data->undo_surface);
+
+  /* oldest first */
+  GromitOp **ops = g_new (GromitOp *, path->len);
+  for (i = 0; i < path->len; ++i)
+    ops[i] = ((GromitUndoNode *) g_ptr_array_index (path, path->len - 1 - i))->op;
+  draw_ops_tiled (data, data->undo_surface, ops, path->len, rect);
+  g_free (ops);
+
+  *keyframe_node = node;
+  n = path->len;
+  g_ptr_array_free (path, TRUE);
+  return n;
+}
+
+
+static void undo_maybe_snap_keyframe (GromitData *data)
+{
+  GromitUndoNode *node = data->undo_current;
+
+  while (!node->keyframe)
+    node = node->parent;
+
+  if (data->undo_current->depth - node->depth < GROMIT_UNDO_KEYFRAME_INTERVAL)
+    return;
+
+  if (!undo_strokes_in_progress (data))
+    {
+      undo_snap_keyframe (data, data->undo_current, data->backbuffer);
+      return;
+    }
+
+  /* someone's unfinished stroke is in the backbuffer, rebuild without it */
+  GdkRectangle rect = { 0, 0, data->width, data->height };
+  undo_rebuild (data, &rect, &node);
+  undo_snap_keyframe (data, data->undo_current, data->undo_surface);
+}
+
+
+/*
+ * Rebuild the given region of the backbuffer from the current node: start
+ * from its nearest ancestor with a keyframe and replay the ops on the way
+ * down, from every user. Strokes still being drawn are composited on top
+ * so they survive someone else's undo.
+ */
+static void undo_restore_region (GromitData *data, GdkRectangle *rect)
+{
+  GromitUndoNode *node;
+  GHashTableIter it;
+  gpointer value;
+  guint replayed = undo_rebuild (data, rect, &node);
+
+  cairo_t *cr = cairo_create (data->undo_surface);
+  gdk_cairo_rectangle (cr, rect);
+  cairo_clip (cr);
+
+  /* LINE, RECT etc. restore this on each motion, so it needs the new state as well */
+  undo_copy_region (data->aux_backbuffer, data->undo_surface, rect);
+
+  g_hash_table_iter_init (&it, data->devdatatable);
+  while (g_hash_table_iter_next (&it, NULL, &value))
+    {
+      GromitDeviceData *devdata = value;
+      /* strokes on a scratch surface are not in the backbuffer yet */
+      if (devdata->cur_op && !devdata->scratch_ctx)
+        draw_op (data, cr, devdata->cur_op);
+    }
+
+  cairo_destroy (cr);
+
+  undo_copy_region (data->backbuffer, data->undo_surface, rect);
+
+  gdk_window_invalidate_rect (gtk_widget_get_window (data->win), rect, 0);
+
+  data->modified = 1;
+
+  if(data->debug)
+    g_printerr ("DEBUG: Replayed %u ops from keyframe at node %u into %dx%d+%d+%d.\n",
+                replayed, node->id, rect->width, rect->height, rect->x, rect->y);
+}
+
+
+static void undo_add_bbox (GromitUndoNode *node, GdkRectangle *rect, gboolean *has_rect)
+{
+  if (*has_rect)
+    gdk_rectangle_union (rect, &node->op->bbox, rect);
+  else
+    *rect = node->op->bbox;
+  *has_rect = TRUE;
+}
+
+
+/*
+ * Make target the current node. Only the ops between both nodes and their
+ * common ancestor are repainted, which takes one keyframe decompression
+ * and at most GROMIT_UNDO_KEYFRAME_INTERVAL replayed ops no matter how
+ * far apart the two states are.
+ */
+static void undo_goto (GromitData *data, GromitUndoNode *target)
+{
+  GromitUndoNode *a = data->undo_current;
+  GromitUndoNode *b = target;
+  GdkRectangle rect;
+  gboolean has_rect = FALSE;
+
+  while (a->depth > b->depth)
+    {
+      undo_add_bbox (a, &rect, &has_rect);
+      a = a->parent;
+    }
+  while (b->depth > a->depth)
+    {
+      undo_add_bbox (b, &rect, &has_rect);
+      b = b->parent;
+    }
+  while (a != b)
+    {
+      undo_add_bbox (a, &rect, &has_rect);
+      undo_add_bbox (b, &rect, &has_rect);
+      a = a->parent;
+      b = b->parent;
+    }
+
+  /* what floats was lifted from the state left here */
+  lasso_end_all (data);
+
+  data->undo_current = target;
+  target->visited = ++data->undo_visits;
+
+  if (has_rect)
+    undo_restore_region (data, &rect);
+
+  undo_maybe_snap_keyframe (data);
+  undo_prune (data);
+}
+
+
+/*
+ * (re-)start the history from the current backbuffer content
+ */
+void undo_init (GromitData *data)
+{
+  GList *ptr;
+
+  if (!data->undo_nodes)
+    {
+      data->undo_nodes = g_hash_table_new (NULL, NULL);
+      data->undo_temp_size = 0x10000;
+      data->undo_temp = g_malloc (data->undo_temp_size);
+      data->undo_temp_used = 0;
+    }
+
+  if (data->undo_root)
+    undo_node_free (data, data->undo_root);
+
+  for (ptr = data->undo_redo; ptr; ptr = ptr->next)
+    {
+      GromitRedo *redo = ptr->data;
+      undo_op_unref (redo->op);
+      g_free (redo);
+    }
+  g_list_free (data->undo_redo);
+  data->undo_redo = NULL;
+
+  data->undo_root = data->undo_current = undo_node_new (data, NULL, NULL);
+  undo_snap_keyframe (data, data->undo_root, data->backbuffer);
+
+  cairo_surface_destroy (data->undo_surface);
+  data->undo_surface = NULL;
+}
+
+
+void undo_op_begin (GromitData *data, GromitDeviceData *devdata)
+{
+  /* a stroke whose button release we never saw */
+  undo_op_commit (data, devdata);
+
+  /* fading ink is gone before anyone could undo it */
+  if (devdata->cur_context->type == GROMIT_LASER)
+    return;
+
+  devdata->cur_op = undo_op_new (GROMIT_OP_STROKE, devdata->cur_context);
+  devdata->cur_op->device = devdata->device;
+}
+
+
+void undo_op_commit (GromitData *data, GromitDeviceData *devdata)
+{
+  GromitOp *op = devdata->cur_op;
+
+  if (!op)
+    return;
+
+  devdata->cur_op = NULL;
+
+  if (op->prims->len == 0)
+    {
+      undo_op_unref (op);
+      return;
+    }
+
+  undo_commit (data, op);
+}
+
+
+static void undo_drop_redo (GromitData *data, GdkDevice *dev)
+{
+  GList *ptr = data->undo_redo;
+
+  while (ptr)
+    {
+      GList *next = ptr->next;
+      GromitRedo *redo = ptr->data;
+      if (redo->device == dev)
+        {
+          undo_op_unref (redo->op);
+          g_free (redo);
+          data->undo_redo = g_list_delete_link (data->undo_redo, ptr);
+        }
+      ptr = next;
+    }
+}
+
+
+/*
+ * add an op that has already been painted to the backbuffer as a new
+ * child of the current node, taking ownership of it
+ */
+void undo_commit (GromitData *data, GromitOp *op)
+{
+  if (!op->has_bbox)
+    {
+      GdkRectangle rect = {0, 0, data->width, data->height};
+      op->bbox = rect;
+      op->has_bbox = TRUE;
+    }
+
+  /*
+    Only the redo future of this op's author is invalidated, the
+    branch it was on stays reachable via undo_goto_node().
+  */
+  undo_drop_redo (data, op->device);
+
+  data->undo_current = undo_node_new (data, data->undo_current, op);
+  data->undo_current->visited = ++data->undo_visits;
+
+  undo_maybe_snap_keyframe (data);
+  undo_prune (data);
+
+  if(data->debug)
+    g_printerr ("DEBUG: Committed op with %u primitives as node %u.\n",
+                op->prims->len, data->undo_current->id);
+}
+
+
+/*
+ * Undo/redo are per pointer: given a device, only ops drawn with it and
+ * shared ops like clearing the screen are considered. Without a device,
+ * any op is.
+ */
+static GdkDevice *undo_pointer_device (GdkDevice *dev)
+{
+  if (dev && gdk_device_get_source (dev) == GDK_SOURCE_KEYBOARD)
+    return gdk_device_get_associated_device (dev);
+  return dev;
+}
+
+
+void undo_drawing (GromitData *data, GdkDevice *dev)
+{
+  GromitUndoNode *node, *target;
+  GPtrArray *later;
+  guint i;
+
+  /* typing in progress is committed first */
+  text_end_all (data);
+
+  dev = undo_pointer_device (dev);
+
+  later = g_ptr_array_new ();
+  for (node = data->undo_current; node->op; node = node->parent)
+    {
+      if (!dev || !node->op->device || node->op->device == dev)
+        break;
+      g_ptr_array_add (later, node);
+    }
+
+  if (!node->op)
+    {
+      g_ptr_array_free (later, TRUE);
+      return;
+    }
+
+  /*
+    When somebody else drew after the op to undo, their ops are re-applied
+    on a new branch without it, sharing their recorded data.
+  */
+  target = node->parent;
+  for (i = later->len; i > 0; --i)
+    target = undo_node_child (data, target, ((GromitUndoNode *) g_ptr_array_index (later, i - 1))->op);
+  g_ptr_array_free (later, TRUE);
+
+  GromitRedo *redo = g_new (GromitRedo, 1);
+  redo->device = dev;
+  redo->op = undo_op_ref (node->op);
+  redo->before = data->undo_current;
+  redo->after = target;
+  data->undo_redo = g_list_prepend (data->undo_redo, redo);
+
+  if(data->debug)
+    g_printerr ("DEBUG: Undo drawing node %u for device '%s', going to node %u.\n", node->id,
+                dev ? gdk_device_get_name (dev) : "any", target->id);
+
+  undo_goto (data, target);
+}
+
+
+void redo_drawing (GromitData *data, GdkDevice *dev)
+{
+  GromitRedo *redo = NULL;
+  GList *ptr;
+
+  /* typing in progress is committed first */
+  text_end_all (data);
+
+  dev = undo_pointer_device (dev);
+
+  for (ptr = data->undo_redo; ptr; ptr = ptr->next)
+    {
+      redo = ptr->data;
+      if (!dev || !redo->device || redo->device == dev)
+        break;
+    }
+  if (!ptr)
+    return;
+
+  data->undo_redo = g_list_delete_link (data->undo_redo, ptr);
+
+  /*
+    If nothing happened since the undo, simply go back. Otherwise
+    re-apply the op on top of what is there now.
+  */
+  GromitUndoNode *target;
+  if (data->undo_current == redo->after)
+    target = redo->before;
+  else
+    target = undo_node_child (data, data->undo_current, redo->op);
+
+  if(data->debug)
+    g_printerr("DEBUG: Redo drawing for device '%s', going to node %u.\n",
+               dev ? gdk_device_get_name (dev) : "any", target->id);
+
+  undo_op_unref (redo->op);
+  g_free (redo);
+
+  undo_goto (data, target);
+}
+
+
+gboolean undo_goto_node (GromitData *data, guint id)
+{
+  GromitUndoNode *node = g_hash_table_lookup (data->undo_nodes, GUINT_TO_POINTER (id));
+
+  if (!node)
+    return FALSE;
+
+  if(data->debug)
+    g_printerr("DEBUG: Going to undo node %u.\n", id);
+
+  text_end_all (data);
+  undo_goto (data, node);
+  return TRUE;
+}
+
+
+static void undo_describe_node (GromitUndoNode *node, GromitUndoNode *current, GString *str)
+{
+  GList *ptr;
+
+  g_string_append_printf (str, "%u ", node->id);
+  if (node->parent)
+    g_string_append_printf (str, "%u ", node->parent->id);
+  else
+    g_string_append (str, "- ");
+
+  if (!node->op)
+    g_string_append (str, "start");
+  else if (node->op->type == GROMIT_OP_CLEAR)
+    g_string_append (str, "clear");
+  else if (node->op->paint_type == GROMIT_TEXT && node->op->device)
+    g_string_append_printf (str, "text '%s'", gdk_device_get_name (node->op->device));
+  else if (node->op->image && node->op->device)
+    g_string_append_printf (str, "stamp '%s'", gdk_device_get_name (node->op->device));
+  else if (node->op->layer && node->op->device)
+    g_string_append_printf (str, "move '%s'", gdk_device_get_name (node->op->device));
+  else if (node->op->mask && node->op->device)
+    g_string_append_printf (str, "fill '%s'", gdk_device_get_name (node->op->device));
+  else if (node->op->device)
+    g_string_append_printf (str, "stroke '%s'", gdk_device_get_name (node->op->device));
+  else
+    g_string_append (str, "line");
+
+  if (node == current)
+    g_string_append (str, " *");
+  g_string_append_c (str, '\n');
+
+  /* children were prepended, list them oldest first */
+  for (ptr = g_list_last (node->children); ptr; ptr = ptr->prev)
+    undo_describe_node (ptr->data, current, str);
+}
+
+
+/*
+ * one line per node of the history: id, parent id, what was done,
+ * and a '*' marking the current state
+ */
+gchar *undo_describe (GromitData *data)
+{
+  GString *str = g_string_new (NULL);
+  undo_describe_node (data->undo_root, data->undo_current, str);
+  return g_string_free (str, FALSE);
+}
@@ -0,0 +1,122 @@
+/*
+ * Gromit-MPX -- a program for painting on the screen
+ *
+ * Gromit Copyright (C) 2000 Simon Budig <Simon.Budig@unix-ag.org>
+ *
+ * Gromit-MPX Copyright (C) 2009,2010 Christian Beier <dontmind@freeshell.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef UNDO_H
+#define UNDO_H
+
+/*
+  Undo/redo history.
+
+  Instead of snapshotting the whole backbuffer on each button press, every
+  committed operation is recorded in a log together with what is needed to
+  replay it. Every GROMIT_UNDO_KEYFRAME_INTERVAL operations, a compressed
+  copy of the backbuffer is stored as a keyframe, or, while someone is in
+  the middle of a stroke, of the committed state rebuilt from the previous
+  keyframe on the side. Undo restores the nearest
+  keyframe and replays the remaining operations into the undone region only.
+*/
+
+#include "main.h"
+
+typedef enum
+{
+  GROMIT_OP_STROKE,
+  GROMIT_OP_CLEAR
+} GromitOpType;
+
+typedef enum
+{
+  GROMIT_PRIM_MOVE,    /* start a new polyline at (x,y), width w */
+  GROMIT_PRIM_LINE,    /* polyline continues to (x,y), width w there */
+  GROMIT_PRIM_ARROW,   /* arrow head at (x,y), width w, direction a */
+  GROMIT_PRIM_CIRCLE,  /* circle around (x,y), line width w, radius a */
+  GROMIT_PRIM_LABEL,   /* the op's label centered at (x,y), text size w */
+  GROMIT_PRIM_TEXT,    /* the op's label as typed, top left at (x,y), text size w */
+  GROMIT_PRIM_MASK,    /* the op's mask filled in with its top left at (x,y) */
+  GROMIT_PRIM_LIFT,    /* the op's mask cut out with its top left at (x,y) */
+  GROMIT_PRIM_PASTE,   /* the op's layer pasted with its top left at (x,y) */
+  GROMIT_PRIM_STAMP,   /* the op's image centered at (x,y), zoomed by w */
+  GROMIT_PRIM_RIM      /* the op's rim filled in below what is there, top left at (x,y) */
+} GromitPrimType;
+
+typedef struct
+{
+  gfloat x, y, w, a;
+  GromitPrimType type;
+} GromitPrim;
+
+struct _GromitOp
+{
+  GromitOpType    type;
+  GromitPaintType paint_type;
+  GdkRGBA         color;
+  GdkRGBA         fill_color;
+  gboolean        has_fill;
+  gboolean        brush;    /* polylines are stamped with dabs, see brush.h */
+  GArray         *prims;    /* of GromitPrim */
+  gchar          *label;
+  cairo_surface_t *mask;    /* of the area a FILL covered or a LASSO lifted */
+  cairo_surface_t *layer;   /* the pixels a LASSO moved */
+  cairo_surface_t *rim;     /* of the pixels around the area a FILL covered */
+  gchar          *image;    /* file a STAMP stamped */
+  GdkRectangle    bbox;
+  gboolean        has_bbox;
+  GdkDevice      *device;   /* the pointer that drew it, NULL for clear and remote ops */
+  gint            ref_count;
+};
+
+typedef struct _GromitKeyframe GromitKeyframe;
+
+struct _GromitUndoNode
+{
+  guint           id;
+  GromitUndoNode *parent;
+  GList          *children;
+  GromitOp       *op;       /* NULL for the root */
+  GromitKeyframe *keyframe; /* backbuffer content in this state, or NULL */
+  guint           depth;
+  guint           visited;  /* when this was last the current node */
+};
+
+GromitOp *undo_op_new (GromitOpType type, GromitPaintContext *context);
+GromitOp *undo_op_ref (GromitOp *op);
+void undo_op_unref (GromitOp *op);
+void undo_op_reset (GromitOp *op);
+void undo_op_add_prim (GromitOp *op, GromitPrimType type,
+                       gfloat x, gfloat y, gfloat w, gfloat a,
+                       GdkRectangle *rect);
+void undo_op_add_line (GromitOp *op, gfloat x1, gfloat y1, gfloat x2, gfloat y2,
+                       gfloat width, GdkRectangle *rect);
+void undo_op_set_label (GromitOp *op, const gchar *label);
+
+void undo_op_begin (GromitData *data, GromitDeviceData *devdata);
+void undo_op_commit (GromitData *data, GromitDeviceData *devdata);
+void undo_commit (GromitData *data, GromitOp *op);
+
+void undo_init (GromitData *data);
+void undo_drawing (GromitData *data, GdkDevice *dev);
+void redo_drawing (GromitData *data, GdkDevice *dev);
+gboolean undo_goto_node (GromitData *data, guint id);
+gchar *undo_describe (GromitData *data);
+
+#endif
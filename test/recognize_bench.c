@@ -0,0 +1,212 @@
+/*
+ * Times recognize_shape() on synthetic noisy gestures and, optionally,
+ * on recorded strokes, and prints what each was recognised as.
+ *
+ * Stroke files hold one "x y [width]" point per line, strokes are
+ * separated by blank lines and lines starting with '#' are ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "drawing.h"
+#include "coordlist_ops.h"
+
+#define BUDGET_MS 1.0   // per call at 10k points
+#define NOISE 1.5       // pixels, uniform
+
+static const char *shape_names[] = {
+    "none", "line", "arrow", "circle", "ellipse", "rect"
+};
+
+typedef struct {
+    gdouble x, y;
+} pt;
+
+static GList *add_coord(GList *list, gdouble x, gdouble y, gfloat width) {
+    GromitStrokeCoordinate *c = g_malloc(sizeof(GromitStrokeCoordinate));
+    c->x = x;
+    c->y = y;
+    c->width = width;
+    return g_list_prepend(list, c);
+}
+
+static GList *copy_stroke(GList *coords) {
+    GList *copy = NULL, *ptr;
+    for (ptr = g_list_last(coords); ptr; ptr = ptr->prev) {
+        GromitStrokeCoordinate *c = ptr->data;
+        copy = add_coord(copy, c->x, c->y, c->width);
+    }
+    return copy;
+}
+
+// n points spread evenly by length along the polyline through v[0..nv-1]
+static GList *polyline(pt *v, gint nv, gint n, GRand *rand) {
+    GList *list = NULL;
+    gdouble total = 0, seg;
+    gint i, k = 0;
+
+    for (i = 1; i < nv; i++)
+        total += hypot(v[i].x - v[i - 1].x, v[i].y - v[i - 1].y);
+
+    gdouble walked = 0;
+    for (i = 0; i < n; i++) {
+        gdouble s = total * i / (n - 1);
+        while (k < nv - 2 &&
+               s > walked + (seg = hypot(v[k + 1].x - v[k].x, v[k + 1].y - v[k].y))) {
+            walked += seg;
+            k++;
+        }
+        seg = hypot(v[k + 1].x - v[k].x, v[k + 1].y - v[k].y);
+        gdouble t = seg > 0 ? CLAMP((s - walked) / seg, 0, 1) : 0;
+        list = add_coord(list,
+                         v[k].x + t * (v[k + 1].x - v[k].x) + g_rand_double_range(rand, -NOISE, NOISE),
+                         v[k].y + t * (v[k + 1].y - v[k].y) + g_rand_double_range(rand, -NOISE, NOISE),
+                         5);
+    }
+    return list;
+}
+
+static GList *ellipse(gdouble a, gdouble b, gdouble angle, gint n, GRand *rand) {
+    GList *list = NULL;
+    gdouble ca = cos(angle), sa = sin(angle);
+    gint i;
+
+    for (i = 0; i < n; i++) {
+        gdouble t = 2 * M_PI * i / (n - 1);
+        gdouble u = a * cos(t), v = b * sin(t);
+        list = add_coord(list,
+                         400 + u * ca - v * sa + g_rand_double_range(rand, -NOISE, NOISE),
+                         300 + u * sa + v * ca + g_rand_double_range(rand, -NOISE, NOISE),
+                         5);
+    }
+    return list;
+}
+
+static GList *gesture(GromitShapeType type, gint n, GRand *rand) {
+    pt line[] = { { 100, 100 }, { 500, 300 } };
+    pt arrow[] = { { 100, 400 }, { 500, 200 }, { 440, 190 }, { 500, 200 }, { 470, 250 } };
+    pt rect[] = { { 200, 150 }, { 600, 150 }, { 600, 400 }, { 200, 400 }, { 200, 150 } };
+
+    switch (type) {
+    case GROMIT_SHAPE_LINE:
+        return polyline(line, G_N_ELEMENTS(line), n, rand);
+    case GROMIT_SHAPE_ARROW:
+        return polyline(arrow, G_N_ELEMENTS(arrow), n, rand);
+    case GROMIT_SHAPE_CIRCLE:
+        return ellipse(150, 150, 0, n, rand);
+    case GROMIT_SHAPE_ELLIPSE:
+        return ellipse(200, 100, M_PI / 6, n, rand);
+    case GROMIT_SHAPE_RECT:
+        return polyline(rect, G_N_ELEMENTS(rect), n, rand);
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * runs recognize_shape() 'runs' times on copies of the stroke, returns
+ * the type and the mean and maximum time of one call in milliseconds
+ */
+static GromitShapeType time_stroke(GList *coords, gfloat tolerance, gint runs,
+                                   gdouble *mean_ms, gdouble *max_ms) {
+    GromitShapeType type = GROMIT_SHAPE_NONE;
+    gdouble sum = 0;
+    gint i;
+
+    *max_ms = 0;
+    for (i = 0; i < runs; i++) {
+        GList *copy = copy_stroke(coords);
+        gfloat head = 0;
+        gint64 t0 = g_get_monotonic_time();
+        type = recognize_shape(&copy, tolerance, &head);
+        gdouble ms = (g_get_monotonic_time() - t0) / 1000.0;
+        sum += ms;
+        *max_ms = MAX(*max_ms, ms);
+        g_list_free_full(copy, g_free);
+    }
+    *mean_ms = sum / runs;
+    return type;
+}
+
+static gint read_strokes(const char *filename, gfloat tolerance) {
+    FILE *f = fopen(filename, "r");
+    char line[256];
+    GList *coords = NULL;
+    gint count = 0;
+
+    if (!f) {
+        perror(filename);
+        return -1;
+    }
+
+    for (;;) {
+        gboolean eof = fgets(line, sizeof(line), f) == NULL;
+        gdouble x, y, width = 5;
+
+        if (!eof && line[0] == '#')
+            continue;
+        if (!eof && sscanf(line, "%lf %lf %lf", &x, &y, &width) >= 2) {
+            coords = add_coord(coords, x, y, width);
+            continue;
+        }
+        if (coords) {
+            gdouble mean_ms, max_ms;
+            gint n = g_list_length(coords);
+            coords = g_list_reverse(coords);
+            GromitShapeType type = time_stroke(coords, tolerance, 20, &mean_ms, &max_ms);
+            printf("%s #%d  %6d points  %-8s  mean %.3f ms  max %.3f ms\n",
+                   filename, ++count, n, shape_names[type], mean_ms, max_ms);
+            g_list_free_full(coords, g_free);
+            coords = NULL;
+        }
+        if (eof)
+            break;
+    }
+    fclose(f);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    gfloat tolerance = 0.05;
+    gint sizes[] = { 200, 10000 };
+    gint i, failed = 0, over = 0;
+    GromitShapeType type;
+
+    if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+        tolerance = atof(argv[2]) / 100;
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc > 1 && argv[1][0] == '-') {
+        printf("Usage: %s [-t <recognize percent>] [stroke file...]\n", argv[0]);
+        return 1;
+    }
+
+    GRand *rand = g_rand_new_with_seed(42);
+    for (i = 0; i < (gint)G_N_ELEMENTS(sizes); i++) {
+        for (type = GROMIT_SHAPE_LINE; type <= GROMIT_SHAPE_RECT; type++) {
+            GList *coords = gesture(type, sizes[i], rand);
+            gdouble mean_ms, max_ms;
+            GromitShapeType got = time_stroke(coords, tolerance, sizes[i] > 1000 ? 20 : 200,
+                                              &mean_ms, &max_ms);
+            gboolean slow = sizes[i] >= 10000 && mean_ms > BUDGET_MS;
+            printf("%-8s %6d points  %-8s  mean %.3f ms  max %.3f ms%s%s\n",
+                   shape_names[type], sizes[i], shape_names[got], mean_ms, max_ms,
+                   got != type ? "  MISMATCH" : "", slow ? "  OVER BUDGET" : "");
+            failed += got != type;
+            over += slow;
+            g_list_free_full(coords, g_free);
+        }
+    }
+    g_rand_free(rand);
+
+    for (i = 1; i < argc; i++)
+        if (read_strokes(argv[i], tolerance) < 0)
+            return 1;
+
+    return failed || over ? 1 : 0;
+}